@@ -58,6 +58,7 @@ static opl_driver_t *driver = NULL;
 static int init_stage_reg_writes = 1;
 
 unsigned int opl_sample_rate = 22050;
+int opl_external_mixing = 0;
 
 //
 // Init/shutdown code.
@@ -135,6 +136,13 @@ opl_init_result_t OPL_Init(unsigned int port_base)
 
     driver_name = getenv("OPL_DRIVER");
 
+    // Only software emulation produces output that someone else can mix.
+
+    if (opl_external_mixing)
+    {
+        return InitDriver(&opl_sdl_driver, port_base);
+    }
+
     if (driver_name != NULL)
     {
         // Search the list until we find the driver with this name.
@@ -185,6 +193,11 @@ void OPL_SetSampleRate(unsigned int rate)
     opl_sample_rate = rate;
 }
 
+void OPL_SetExternalMixing(int enabled)
+{
+    opl_external_mixing = enabled;
+}
+
 void OPL_WritePort(opl_port_t port, unsigned int value)
 {
     if (driver != NULL)
@@ -489,6 +502,20 @@ void OPL_Delay(uint64_t us)
 
     OPL_SetCallback(us, DelayCallback, &delay_data);
 
+    // With external mixing, time only passes as output is generated, so
+    // generate (and throw away) output until the callback is invoked.
+
+    if (opl_external_mixing)
+    {
+        int16_t buffer[64 * 2];
+
+        while (!delay_data.finished)
+        {
+            memset(buffer, 0, sizeof(buffer));
+            OPL_Render(buffer, 64);
+        }
+    }
+
     // Wait until the callback is invoked.
 
     SDL_LockMutex(delay_data.mutex);
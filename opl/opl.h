@@ -85,6 +85,17 @@ void OPL_Shutdown(void);
 
 void OPL_SetSampleRate(unsigned int rate);
 
+// Use software emulation, but leave playing its output to the caller, who
+// generates it with OPL_Render.  Must be called before OPL_Init.
+
+void OPL_SetExternalMixing(int enabled);
+
+// Mix the next nsamples of software emulation output (16-bit signed
+// stereo) into buffer, invoking any callbacks that come due.  Only used
+// with external mixing.
+
+void OPL_Render(int16_t *buffer, unsigned int nsamples);
+
 // Write to one of the OPL I/O ports:
 
 void OPL_WritePort(opl_port_t port, unsigned int value);
@@ -54,5 +54,10 @@ typedef struct
 
 extern unsigned int opl_sample_rate;
 
+// If non-zero, software emulation output is generated with OPL_Render
+// rather than played through SDL_mixer.
+
+extern int opl_external_mixing;
+
 #endif /* #ifndef OPL_INTERNAL_H */
 
@@ -93,6 +93,11 @@ static int sdl_was_initialized = 0;
 static int mixing_freq, mixing_channels;
 static Uint16 mixing_format;
 
+// Set while the emulator is running for OPL_Render, rather than
+// for SDL_mixer.
+
+static int external_mixing_active = 0;
+
 static int SDLIsInitialized(void)
 {
     int freq, channels;
@@ -224,7 +229,18 @@ static void OPL_Mix_Callback(void *udata, Uint8 *buffer, int len)
 
 static void OPL_SDL_Shutdown(void)
 {
-    Mix_HookMusic(NULL, NULL);
+    if (external_mixing_active)
+    {
+        external_mixing_active = 0;
+        OPL_Queue_Destroy(callback_queue);
+        callback_queue = NULL;
+        free(mix_buffer);
+        mix_buffer = NULL;
+    }
+    else
+    {
+        Mix_HookMusic(NULL, NULL);
+    }
 
     if (sdl_was_initialized)
     {
@@ -282,10 +298,14 @@ static unsigned int GetSliceSize(void)
 
 static int OPL_SDL_Init(unsigned int port_base)
 {
-    // Check if SDL_mixer has been opened already
-    // If not, we must initialize it now
+    // With external mixing, the emulator just runs at the requested rate
+    // and SDL's audio is left alone.
 
-    if (!SDLIsInitialized())
+    if (opl_external_mixing)
+    {
+        sdl_was_initialized = 0;
+    }
+    else if (!SDLIsInitialized())
     {
         if (SDL_Init(SDL_INIT_AUDIO) < 0)
         {
@@ -323,7 +343,16 @@ static int OPL_SDL_Init(unsigned int port_base)
 
     // Get the mixer frequency, format and number of channels.
 
-    Mix_QuerySpec(&mixing_freq, &mixing_format, &mixing_channels);
+    if (opl_external_mixing)
+    {
+        mixing_freq = opl_sample_rate;
+        mixing_format = AUDIO_S16SYS;
+        mixing_channels = 2;
+    }
+    else
+    {
+        Mix_QuerySpec(&mixing_freq, &mixing_format, &mixing_channels);
+    }
 
     // Only supports AUDIO_S16SYS
 
@@ -348,6 +377,12 @@ static int OPL_SDL_Init(unsigned int port_base)
     callback_mutex = SDL_CreateMutex();
     callback_queue_mutex = SDL_CreateMutex();
 
+    if (opl_external_mixing)
+    {
+        external_mixing_active = 1;
+        return 1;
+    }
+
     // Set postmix that adds the OPL music. This is deliberately done
     // as a postmix and not using Mix_HookMusic() as the latter disables
     // normal SDL_mixer music mixing.
@@ -356,6 +391,31 @@ static int OPL_SDL_Init(unsigned int port_base)
     return 1;
 }
 
+void OPL_Render(int16_t *buffer, unsigned int nsamples)
+{
+    if (!external_mixing_active)
+    {
+        return;
+    }
+
+    // The mixing callback works in slices of under a second, the length
+    // of mix_buffer.
+
+    while (nsamples > 0)
+    {
+        unsigned int slice = nsamples;
+
+        if (slice > mixing_freq / 2)
+        {
+            slice = mixing_freq / 2;
+        }
+
+        OPL_Mix_Callback(NULL, (Uint8 *) buffer, slice * 4);
+        buffer += slice * 2;
+        nsamples -= slice;
+    }
+}
+
 static unsigned int OPL_SDL_PortRead(opl_port_t port)
 {
     unsigned int result = 0;
@@ -180,6 +180,7 @@ static boolean BuildNewTic(void)
     //printf ("mk:%i ",maketic);
     memset(&cmd, 0, sizeof(ticcmd_t));
     loop_interface->BuildTiccmd(&cmd, maketic);
+    I_TicBuilt(maketic);
 
     if (net_client_connected)
     {
@@ -789,6 +790,8 @@ void TryRunTics (void)
             TicdupSquash(set);
 	}
 
+        I_TicRun(gametic / ticdup - 1);
+
 	NetUpdate ();	// check for new console commands
     }
 }
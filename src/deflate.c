@@ -0,0 +1,1015 @@
+//
+// Copyright(C) 2021 Chris Marchetti <adamnew123456@gmail.com>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//     Minimal zlib-compatible DEFLATE (RFC 1950/1951) compressor.
+//
+//     This exists so that Tight encoding in the VNC server can actually
+//     compress without pulling in zlib. It only does what that needs: a
+//     single long-lived stream that is sync-flushed after every write, with
+//     LZ77 matching over hash chains and a choice of stored, fixed or dynamic
+//     Huffman blocks, whichever comes out smallest. The parameters are tuned
+//     for 8-bit palette indices, which have long runs of a single value and
+//     lots of short repeats (textures, flats, the status bar).
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "deflate.h"
+
+#define WINDOW_MASK (DEFLATE_WINDOW_SIZE - 1)
+#define HASH_SIZE (1 << DEFLATE_HASH_BITS)
+
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+
+// Length-3 matches this far back cost about as much as the literals
+#define TOO_FAR 4096
+
+// How many hash chain entries to follow looking for a match, and the match
+// length past which we stop looking for a better one (either immediately
+// or at the next position)
+#define MAX_CHAIN 64
+#define GOOD_MATCH 32
+#define NICE_MATCH 128
+
+#define LITLEN_CODES 286
+#define DIST_CODES 30
+#define CODELEN_CODES 19
+#define MAX_BITS 15
+#define MAX_CODELEN_BITS 7
+
+static const int length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const int length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const int dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577
+};
+
+static const int dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// The order code length code lengths are transmitted in
+static const int codelen_order[CODELEN_CODES] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+// Lookup tables from match length (3-258) and distance to their codes,
+// filled in the first time a stream is created
+static byte length_code[MAX_MATCH + 1];
+static byte dist_code_low[257];
+static byte dist_code_high[256];
+static boolean tables_ready = false;
+
+// The fixed literal/length tree covers 288 codes even though only 286 of
+// them can ever appear, and the last two still take up space in the code
+#define FIXED_LITLEN_CODES 288
+
+typedef struct {
+    byte lengths[FIXED_LITLEN_CODES];
+    uint16_t codes[FIXED_LITLEN_CODES];
+} huffman_t;
+
+static huffman_t fixed_litlen;
+static huffman_t fixed_dist;
+
+static void BuildCodes(huffman_t *tree, int count);
+
+static void InitTables(void)
+{
+    int code;
+    int i;
+
+    for (code = 0; code < 29; code++)
+    {
+        int count = 1 << length_extra[code];
+        for (i = 0; i < count && length_base[code] + i <= MAX_MATCH; i++)
+        {
+            length_code[length_base[code] + i] = code;
+        }
+    }
+
+    // 258 has its own code, even though 284 could also represent it
+    length_code[MAX_MATCH] = 28;
+
+    for (code = 0; code < 30; code++)
+    {
+        int count = 1 << dist_extra[code];
+        for (i = 0; i < count; i++)
+        {
+            int dist = dist_base[code] + i;
+            if (dist <= 256)
+            {
+                dist_code_low[dist] = code;
+            }
+            else
+            {
+                dist_code_high[(dist - 1) >> 7] = code;
+            }
+        }
+    }
+
+    for (i = 0; i < 144; i++)
+    {
+        fixed_litlen.lengths[i] = 8;
+    }
+    for (; i < 256; i++)
+    {
+        fixed_litlen.lengths[i] = 9;
+    }
+    for (; i < 280; i++)
+    {
+        fixed_litlen.lengths[i] = 7;
+    }
+    for (; i < FIXED_LITLEN_CODES; i++)
+    {
+        fixed_litlen.lengths[i] = 8;
+    }
+    BuildCodes(&fixed_litlen, FIXED_LITLEN_CODES);
+
+    for (i = 0; i < DIST_CODES; i++)
+    {
+        fixed_dist.lengths[i] = 5;
+    }
+    BuildCodes(&fixed_dist, DIST_CODES);
+
+    tables_ready = true;
+}
+
+static int DistCode(int dist)
+{
+    return dist <= 256 ? dist_code_low[dist] : dist_code_high[(dist - 1) >> 7];
+}
+
+//
+// Bit output
+//
+
+static void PutBits(deflate_stream_t *stream, uint32_t value, int bits)
+{
+    stream->bit_buffer |= value << stream->bit_count;
+    stream->bit_count += bits;
+
+    while (stream->bit_count >= 8)
+    {
+        stream->out[stream->out_pos++] = stream->bit_buffer & 0xff;
+        stream->bit_buffer >>= 8;
+        stream->bit_count -= 8;
+    }
+}
+
+static void AlignToByte(deflate_stream_t *stream)
+{
+    if (stream->bit_count > 0)
+    {
+        stream->out[stream->out_pos++] = stream->bit_buffer & 0xff;
+    }
+
+    stream->bit_buffer = 0;
+    stream->bit_count = 0;
+}
+
+//
+// Huffman trees
+//
+
+// Assigns canonical codes for the given code lengths. The codes are stored
+// bit-reversed since DEFLATE sends Huffman codes most significant bit first
+// while everything else goes least significant bit first.
+static void BuildCodes(huffman_t *tree, int count)
+{
+    int bl_count[MAX_BITS + 1];
+    int next_code[MAX_BITS + 1];
+    int code = 0;
+    int i;
+
+    memset(bl_count, 0, sizeof(bl_count));
+    for (i = 0; i < count; i++)
+    {
+        bl_count[tree->lengths[i]]++;
+    }
+    bl_count[0] = 0;
+
+    for (i = 1; i <= MAX_BITS; i++)
+    {
+        code = (code + bl_count[i - 1]) << 1;
+        next_code[i] = code;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        int len = tree->lengths[i];
+        int reversed = 0;
+        int value;
+        int bit;
+
+        if (len == 0)
+        {
+            tree->codes[i] = 0;
+            continue;
+        }
+
+        value = next_code[len]++;
+        for (bit = 0; bit < len; bit++)
+        {
+            reversed = (reversed << 1) | ((value >> bit) & 1);
+        }
+
+        tree->codes[i] = reversed;
+    }
+}
+
+// Works out Huffman code lengths for the given symbol frequencies, no longer
+// than max_bits. If the optimal tree is too deep the frequencies are
+// flattened and it's built again; that rarely happens with the block sizes
+// we use and costs very little when it does.
+static void BuildLengths(huffman_t *tree, const int *freqs, int count,
+                         int max_bits)
+{
+    int weight[2 * LITLEN_CODES];
+    int parent[2 * LITLEN_CODES];
+    int leaves[LITLEN_CODES];
+    int scaled[LITLEN_CODES];
+    int used = 0;
+    int shift = 0;
+    int i;
+
+    memset(tree->lengths, 0, sizeof(tree->lengths));
+
+    for (i = 0; i < count; i++)
+    {
+        if (freqs[i] > 0)
+        {
+            leaves[used++] = i;
+        }
+    }
+
+    // Inflaters want at least two codes in a tree (zlib will take a single
+    // code of length one, but not every client uses zlib)
+    if (used < 2)
+    {
+        tree->lengths[0] = 1;
+        tree->lengths[used == 1 && leaves[0] != 0 ? leaves[0] : 1] = 1;
+        BuildCodes(tree, count);
+        return;
+    }
+
+    for (;;)
+    {
+        int nodes = used;
+        int max_len = 0;
+        int lo_leaf = 0;
+        int lo_node = used;
+
+        for (i = 0; i < used; i++)
+        {
+            scaled[i] = freqs[leaves[i]] >> shift;
+            if (scaled[i] == 0)
+            {
+                scaled[i] = 1;
+            }
+        }
+
+        // Sort the leaves by weight (insertion sort; there are at most 286)
+        for (i = 1; i < used; i++)
+        {
+            int leaf = leaves[i];
+            int w = scaled[i];
+            int j = i - 1;
+
+            while (j >= 0 && scaled[j] > w)
+            {
+                leaves[j + 1] = leaves[j];
+                scaled[j + 1] = scaled[j];
+                j--;
+            }
+
+            leaves[j + 1] = leaf;
+            scaled[j + 1] = w;
+        }
+
+        for (i = 0; i < used; i++)
+        {
+            weight[i] = scaled[i];
+        }
+
+        // Two-queue construction: the sorted leaves are one queue and the
+        // internal nodes, which are created in increasing weight order, are
+        // the other
+        while (nodes < 2 * used - 1)
+        {
+            int pick[2];
+            int k;
+
+            for (k = 0; k < 2; k++)
+            {
+                if (lo_leaf < used
+                 && (lo_node >= nodes || weight[lo_leaf] <= weight[lo_node]))
+                {
+                    pick[k] = lo_leaf++;
+                }
+                else
+                {
+                    pick[k] = lo_node++;
+                }
+            }
+
+            weight[nodes] = weight[pick[0]] + weight[pick[1]];
+            parent[pick[0]] = nodes;
+            parent[pick[1]] = nodes;
+            nodes++;
+        }
+
+        // Depth of each leaf is its distance from the root, which is the
+        // last node created
+        for (i = 0; i < used; i++)
+        {
+            int depth = 0;
+            int node = i;
+
+            while (node != nodes - 1)
+            {
+                node = parent[node];
+                depth++;
+            }
+
+            tree->lengths[leaves[i]] = depth;
+            if (depth > max_len)
+            {
+                max_len = depth;
+            }
+        }
+
+        if (max_len <= max_bits)
+        {
+            break;
+        }
+
+        memset(tree->lengths, 0, sizeof(tree->lengths));
+        shift++;
+    }
+
+    BuildCodes(tree, count);
+}
+
+//
+// Block output
+//
+
+static void CountFrequencies(deflate_stream_t *stream, int *litlen_freqs,
+                             int *dist_freqs)
+{
+    int i;
+
+    memset(litlen_freqs, 0, LITLEN_CODES * sizeof(int));
+    memset(dist_freqs, 0, DIST_CODES * sizeof(int));
+
+    for (i = 0; i < stream->token_count; i++)
+    {
+        if (stream->token_dist[i] == 0)
+        {
+            litlen_freqs[stream->token_value[i]]++;
+        }
+        else
+        {
+            litlen_freqs[257 + length_code[stream->token_value[i]]]++;
+            dist_freqs[DistCode(stream->token_dist[i])]++;
+        }
+    }
+
+    // End of block
+    litlen_freqs[256] = 1;
+}
+
+// Size in bits of the block's symbols under the given trees, not counting
+// the block header or tree description
+static int SymbolBits(const int *litlen_freqs, const int *dist_freqs,
+                      const huffman_t *litlen, const huffman_t *dist)
+{
+    int bits = 0;
+    int i;
+
+    for (i = 0; i < 257; i++)
+    {
+        bits += litlen_freqs[i] * litlen->lengths[i];
+    }
+
+    for (i = 0; i < 29; i++)
+    {
+        bits += litlen_freqs[257 + i] * (litlen->lengths[257 + i] + length_extra[i]);
+    }
+
+    for (i = 0; i < DIST_CODES; i++)
+    {
+        bits += dist_freqs[i] * (dist->lengths[i] + dist_extra[i]);
+    }
+
+    return bits;
+}
+
+// Run-length encodes the concatenated literal/length and distance code
+// lengths using the code length alphabet (16 = repeat previous, 17 and 18 =
+// runs of zeroes). Each entry is a symbol in the low byte and its extra bits
+// value in the high byte.
+static int EncodeCodeLengths(const byte *lengths, int count, uint16_t *out,
+                             int *freqs)
+{
+    int out_count = 0;
+    int i = 0;
+
+    memset(freqs, 0, CODELEN_CODES * sizeof(int));
+
+    while (i < count)
+    {
+        int len = lengths[i];
+        int run = 1;
+
+        while (i + run < count && lengths[i + run] == len)
+        {
+            run++;
+        }
+
+        i += run;
+
+        if (len == 0)
+        {
+            while (run >= 11)
+            {
+                int n = run > 138 ? 138 : run;
+                out[out_count++] = 18 | ((n - 11) << 8);
+                freqs[18]++;
+                run -= n;
+            }
+            if (run >= 3)
+            {
+                out[out_count++] = 17 | ((run - 3) << 8);
+                freqs[17]++;
+                run = 0;
+            }
+        }
+        else
+        {
+            out[out_count++] = len;
+            freqs[len]++;
+            run--;
+
+            while (run >= 3)
+            {
+                int n = run > 6 ? 6 : run;
+                out[out_count++] = 16 | ((n - 3) << 8);
+                freqs[16]++;
+                run -= n;
+            }
+        }
+
+        while (run > 0)
+        {
+            out[out_count++] = len;
+            freqs[len]++;
+            run--;
+        }
+    }
+
+    return out_count;
+}
+
+static void WriteSymbols(deflate_stream_t *stream, const huffman_t *litlen,
+                         const huffman_t *dist)
+{
+    int i;
+
+    for (i = 0; i < stream->token_count; i++)
+    {
+        int value = stream->token_value[i];
+        int distance = stream->token_dist[i];
+
+        if (distance == 0)
+        {
+            PutBits(stream, litlen->codes[value], litlen->lengths[value]);
+        }
+        else
+        {
+            int lcode = length_code[value];
+            int dcode = DistCode(distance);
+
+            PutBits(stream, litlen->codes[257 + lcode], litlen->lengths[257 + lcode]);
+            PutBits(stream, value - length_base[lcode], length_extra[lcode]);
+            PutBits(stream, dist->codes[dcode], dist->lengths[dcode]);
+            PutBits(stream, distance - dist_base[dcode], dist_extra[dcode]);
+        }
+    }
+
+    PutBits(stream, litlen->codes[256], litlen->lengths[256]);
+}
+
+static void WriteStoredBlocks(deflate_stream_t *stream, const byte *data,
+                              int len)
+{
+    // A stored block can hold at most 65535 bytes, and we need at least one
+    // even if there is no data so that a sync flush marker can be written
+    do
+    {
+        int chunk = len > 0xffff ? 0xffff : len;
+
+        PutBits(stream, 0, 3);
+        AlignToByte(stream);
+        stream->out[stream->out_pos++] = chunk & 0xff;
+        stream->out[stream->out_pos++] = (chunk >> 8) & 0xff;
+        stream->out[stream->out_pos++] = ~chunk & 0xff;
+        stream->out[stream->out_pos++] = (~chunk >> 8) & 0xff;
+        if (chunk > 0)
+        {
+            memcpy(stream->out + stream->out_pos, data, chunk);
+            stream->out_pos += chunk;
+            data += chunk;
+            len -= chunk;
+        }
+    } while (len > 0);
+}
+
+// Emits the tokens collected so far as a single block, using whichever
+// block type is smallest
+static void FlushBlock(deflate_stream_t *stream, int block_end)
+{
+    int litlen_freqs[LITLEN_CODES];
+    int dist_freqs[DIST_CODES];
+    int codelen_freqs[CODELEN_CODES];
+    byte all_lengths[LITLEN_CODES + DIST_CODES];
+    uint16_t codelen_symbols[LITLEN_CODES + DIST_CODES];
+    huffman_t litlen;
+    huffman_t dist;
+    huffman_t codelen;
+    int raw_len = block_end - stream->block_start;
+    int hlit, hdist, hclen;
+    int codelen_count;
+    int fixed_bits, dynamic_bits, stored_bits;
+    int i;
+
+    if (raw_len == 0)
+    {
+        return;
+    }
+
+    CountFrequencies(stream, litlen_freqs, dist_freqs);
+    BuildLengths(&litlen, litlen_freqs, LITLEN_CODES, MAX_BITS);
+    BuildLengths(&dist, dist_freqs, DIST_CODES, MAX_BITS);
+
+    for (hlit = LITLEN_CODES; hlit > 257 && litlen.lengths[hlit - 1] == 0; hlit--);
+    for (hdist = DIST_CODES; hdist > 1 && dist.lengths[hdist - 1] == 0; hdist--);
+
+    memcpy(all_lengths, litlen.lengths, hlit);
+    memcpy(all_lengths + hlit, dist.lengths, hdist);
+    codelen_count = EncodeCodeLengths(all_lengths, hlit + hdist,
+                                      codelen_symbols, codelen_freqs);
+    BuildLengths(&codelen, codelen_freqs, CODELEN_CODES, MAX_CODELEN_BITS);
+
+    for (hclen = CODELEN_CODES;
+         hclen > 4 && codelen.lengths[codelen_order[hclen - 1]] == 0;
+         hclen--);
+
+    dynamic_bits = 3 + 14 + hclen * 3
+                 + SymbolBits(litlen_freqs, dist_freqs, &litlen, &dist);
+    for (i = 0; i < codelen_count; i++)
+    {
+        int symbol = codelen_symbols[i] & 0xff;
+        dynamic_bits += codelen.lengths[symbol];
+        dynamic_bits += symbol == 16 ? 2 : symbol == 17 ? 3 : symbol == 18 ? 7 : 0;
+    }
+
+    fixed_bits = 3 + SymbolBits(litlen_freqs, dist_freqs,
+                                &fixed_litlen, &fixed_dist);
+
+    stored_bits = ((raw_len + 0xfffe) / 0xffff) * (3 + 7 + 32) + raw_len * 8;
+
+    if (stored_bits <= fixed_bits && stored_bits <= dynamic_bits)
+    {
+        WriteStoredBlocks(stream, stream->window + stream->block_start, raw_len);
+    }
+    else if (fixed_bits <= dynamic_bits)
+    {
+        PutBits(stream, 1 << 1, 3);
+        WriteSymbols(stream, &fixed_litlen, &fixed_dist);
+    }
+    else
+    {
+        PutBits(stream, 2 << 1, 3);
+        PutBits(stream, hlit - 257, 5);
+        PutBits(stream, hdist - 1, 5);
+        PutBits(stream, hclen - 4, 4);
+
+        for (i = 0; i < hclen; i++)
+        {
+            PutBits(stream, codelen.lengths[codelen_order[i]], 3);
+        }
+
+        for (i = 0; i < codelen_count; i++)
+        {
+            int symbol = codelen_symbols[i] & 0xff;
+            int extra = codelen_symbols[i] >> 8;
+
+            PutBits(stream, codelen.codes[symbol], codelen.lengths[symbol]);
+            if (symbol == 16)
+            {
+                PutBits(stream, extra, 2);
+            }
+            else if (symbol == 17)
+            {
+                PutBits(stream, extra, 3);
+            }
+            else if (symbol == 18)
+            {
+                PutBits(stream, extra, 7);
+            }
+        }
+
+        WriteSymbols(stream, &litlen, &dist);
+    }
+
+    stream->token_count = 0;
+    stream->block_start = block_end;
+}
+
+//
+// LZ77 matching
+//
+
+static int Hash(const byte *data)
+{
+    uint32_t key = (data[0] << 16) | (data[1] << 8) | data[2];
+    return (key * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+// Adds every position before pos that has three bytes of data after it
+// to the hash chains
+static void InsertUpTo(deflate_stream_t *stream, int pos)
+{
+    int limit = stream->window_end - (MIN_MATCH - 1);
+
+    if (pos > limit)
+    {
+        pos = limit;
+    }
+
+    while (stream->hashed_upto < pos)
+    {
+        int p = stream->hashed_upto++;
+        int h = Hash(stream->window + p);
+
+        stream->prev[p & WINDOW_MASK] = stream->head[h];
+        stream->head[h] = p + 1;
+    }
+}
+
+static int LongestMatch(deflate_stream_t *stream, int pos, int *match_dist,
+                        int prev_length)
+{
+    const byte *window = stream->window;
+    int max_len = stream->window_end - pos;
+    int best_len = prev_length;
+    int chain = prev_length >= GOOD_MATCH ? MAX_CHAIN / 4 : MAX_CHAIN;
+    int candidate;
+
+    if (max_len > MAX_MATCH)
+    {
+        max_len = MAX_MATCH;
+    }
+
+    if (max_len < MIN_MATCH || best_len >= max_len)
+    {
+        return 0;
+    }
+
+    // Try the caller's hint first, a long enough match there means we don't
+    // have to walk the chain at all
+    if (stream->repeat_distance > 0 && stream->repeat_distance <= pos
+     && stream->repeat_distance <= DEFLATE_WINDOW_SIZE)
+    {
+        int cpos = pos - stream->repeat_distance;
+        int len = 0;
+
+        while (len < max_len && window[cpos + len] == window[pos + len])
+        {
+            len++;
+        }
+
+        if (len > best_len)
+        {
+            best_len = len;
+            *match_dist = stream->repeat_distance;
+
+            if (len >= NICE_MATCH || len == max_len)
+            {
+                return best_len;
+            }
+        }
+    }
+
+    candidate = stream->head[Hash(window + pos)];
+
+    while (candidate > 0 && chain-- > 0)
+    {
+        int cpos = candidate - 1;
+        int len;
+
+        if (pos - cpos > DEFLATE_WINDOW_SIZE || cpos >= pos)
+        {
+            break;
+        }
+
+        // Quick reject: the byte that would extend the best match has to
+        // match before it's worth comparing the rest
+        if (window[cpos + best_len] == window[pos + best_len]
+         && window[cpos] == window[pos])
+        {
+            len = 1;
+            while (len < max_len && window[cpos + len] == window[pos + len])
+            {
+                len++;
+            }
+
+            if (len > best_len)
+            {
+                best_len = len;
+                *match_dist = pos - cpos;
+
+                if (len >= NICE_MATCH || len == max_len)
+                {
+                    break;
+                }
+            }
+        }
+
+        candidate = stream->prev[cpos & WINDOW_MASK];
+    }
+
+    return best_len > prev_length ? best_len : 0;
+}
+
+static void AddToken(deflate_stream_t *stream, int value, int dist, int pos_after)
+{
+    stream->token_value[stream->token_count] = value;
+    stream->token_dist[stream->token_count] = dist;
+    stream->token_count++;
+
+    if (stream->token_count == DEFLATE_MAX_TOKENS)
+    {
+        FlushBlock(stream, pos_after);
+    }
+}
+
+// Turns window[start..window_end) into tokens. This uses one step of lazy
+// matching: a match is only taken if the match starting at the next byte
+// isn't any longer, which catches the common case of a short match hiding
+// the start of a long run.
+static void CompressWindow(deflate_stream_t *stream, int start)
+{
+    int end = stream->window_end;
+    int pos = start;
+    int prev_len = 0;
+    int prev_dist = 0;
+    boolean prev_pending = false;
+
+    while (pos < end)
+    {
+        int cur_len = 0;
+        int cur_dist = 0;
+
+        InsertUpTo(stream, pos);
+
+        if (prev_len < GOOD_MATCH)
+        {
+            cur_len = LongestMatch(stream, pos, &cur_dist,
+                                   prev_len > MIN_MATCH - 1 ? prev_len : MIN_MATCH - 1);
+
+            if (cur_len == MIN_MATCH && cur_dist > TOO_FAR)
+            {
+                cur_len = 0;
+            }
+        }
+
+        if (prev_pending && prev_len >= MIN_MATCH && cur_len <= prev_len)
+        {
+            // The match from the previous byte wins
+            int match_start = pos - 1;
+
+            AddToken(stream, prev_len, prev_dist, match_start + prev_len);
+            pos = match_start + prev_len;
+            prev_pending = false;
+            prev_len = 0;
+        }
+        else
+        {
+            if (prev_pending)
+            {
+                AddToken(stream, stream->window[pos - 1], 0, pos);
+            }
+
+            prev_pending = true;
+            prev_len = cur_len;
+            prev_dist = cur_dist;
+            pos++;
+        }
+    }
+
+    if (prev_pending)
+    {
+        if (prev_len >= MIN_MATCH)
+        {
+            AddToken(stream, prev_len, prev_dist, pos - 1 + prev_len);
+        }
+        else
+        {
+            AddToken(stream, stream->window[pos - 1], 0, pos);
+        }
+    }
+}
+
+// Drops the older half of the window once it's full, keeping the most
+// recent DEFLATE_WINDOW_SIZE bytes around for matching
+static void SlideWindow(deflate_stream_t *stream)
+{
+    int i;
+
+    memmove(stream->window, stream->window + DEFLATE_WINDOW_SIZE,
+            stream->window_end - DEFLATE_WINDOW_SIZE);
+    stream->window_end -= DEFLATE_WINDOW_SIZE;
+    stream->hashed_upto -= DEFLATE_WINDOW_SIZE;
+    stream->block_start -= DEFLATE_WINDOW_SIZE;
+
+    for (i = 0; i < HASH_SIZE; i++)
+    {
+        int p = stream->head[i];
+        stream->head[i] = p > DEFLATE_WINDOW_SIZE ? p - DEFLATE_WINDOW_SIZE : 0;
+    }
+
+    for (i = 0; i < DEFLATE_WINDOW_SIZE; i++)
+    {
+        int p = stream->prev[i];
+        stream->prev[i] = p > DEFLATE_WINDOW_SIZE ? p - DEFLATE_WINDOW_SIZE : 0;
+    }
+}
+
+void DEFLATE_Init(deflate_stream_t *stream)
+{
+    if (!tables_ready)
+    {
+        InitTables();
+    }
+
+    stream->window = malloc(2 * DEFLATE_WINDOW_SIZE);
+    stream->head = malloc(HASH_SIZE * sizeof(int));
+    stream->prev = malloc(DEFLATE_WINDOW_SIZE * sizeof(int));
+    stream->token_value = malloc(DEFLATE_MAX_TOKENS * sizeof(uint16_t));
+    stream->token_dist = malloc(DEFLATE_MAX_TOKENS * sizeof(uint16_t));
+
+    DEFLATE_Reset(stream);
+}
+
+void DEFLATE_Free(deflate_stream_t *stream)
+{
+    free(stream->window);
+    free(stream->head);
+    free(stream->prev);
+    free(stream->token_value);
+    free(stream->token_dist);
+
+    stream->window = NULL;
+    stream->head = NULL;
+    stream->prev = NULL;
+    stream->token_value = NULL;
+    stream->token_dist = NULL;
+}
+
+void DEFLATE_Reset(deflate_stream_t *stream)
+{
+    memset(stream->head, 0, HASH_SIZE * sizeof(int));
+    memset(stream->prev, 0, DEFLATE_WINDOW_SIZE * sizeof(int));
+
+    stream->window_end = 0;
+    stream->hashed_upto = 0;
+    stream->repeat_distance = 0;
+    stream->token_count = 0;
+    stream->block_start = 0;
+    stream->bit_buffer = 0;
+    stream->bit_count = 0;
+    stream->started = false;
+}
+
+void DEFLATE_SetRepeatDistance(deflate_stream_t *stream, int distance)
+{
+    stream->repeat_distance = distance;
+}
+
+static void StartOutput(deflate_stream_t *stream, byte *out)
+{
+    stream->out = out;
+    stream->out_pos = 0;
+
+    if (!stream->started)
+    {
+        // CMF: DEFLATE with a 32K window. FLG: no preset dictionary, and
+        // check bits making the pair a multiple of 31.
+        stream->out[stream->out_pos++] = 0x78;
+        stream->out[stream->out_pos++] = 0x01;
+        stream->started = true;
+    }
+}
+
+int DEFLATE_Compress(deflate_stream_t *stream, const byte *in, int len,
+                     byte *out)
+{
+    StartOutput(stream, out);
+
+    while (len > 0)
+    {
+        int chunk;
+        int start;
+
+        if (stream->window_end == 2 * DEFLATE_WINDOW_SIZE)
+        {
+            FlushBlock(stream, stream->window_end);
+            SlideWindow(stream);
+        }
+
+        chunk = 2 * DEFLATE_WINDOW_SIZE - stream->window_end;
+        if (chunk > len)
+        {
+            chunk = len;
+        }
+
+        start = stream->window_end;
+        memcpy(stream->window + start, in, chunk);
+        stream->window_end += chunk;
+        in += chunk;
+        len -= chunk;
+
+        CompressWindow(stream, start);
+    }
+
+    FlushBlock(stream, stream->window_end);
+
+    // Sync flush: an empty stored block leaves the output byte aligned and
+    // tells the inflater it has everything up to this point
+    WriteStoredBlocks(stream, NULL, 0);
+
+    return stream->out_pos;
+}
+
+int DEFLATE_Store(deflate_stream_t *stream, const byte *in, int len,
+                  byte *out)
+{
+    StartOutput(stream, out);
+
+    while (len > 0)
+    {
+        int chunk;
+
+        if (stream->window_end == 2 * DEFLATE_WINDOW_SIZE)
+        {
+            SlideWindow(stream);
+        }
+
+        chunk = 2 * DEFLATE_WINDOW_SIZE - stream->window_end;
+        if (chunk > len)
+        {
+            chunk = len;
+        }
+
+        memcpy(stream->window + stream->window_end, in, chunk);
+        WriteStoredBlocks(stream, in, chunk);
+        stream->window_end += chunk;
+        in += chunk;
+        len -= chunk;
+    }
+
+    // Nothing here goes on the hash chains, so only the repeat distance can
+    // find matches in it later on
+    stream->hashed_upto = stream->window_end;
+    stream->block_start = stream->window_end;
+
+    WriteStoredBlocks(stream, NULL, 0);
+
+    return stream->out_pos;
+}
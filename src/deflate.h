@@ -0,0 +1,92 @@
+//
+// Copyright(C) 2021 Chris Marchetti <adamnew123456@gmail.com>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//     Minimal zlib-compatible DEFLATE (RFC 1950/1951) compressor.
+//
+
+#ifndef __DEFLATE_H__
+#define __DEFLATE_H__
+
+#include "doomtype.h"
+
+#define DEFLATE_WINDOW_SIZE 32768
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_MAX_TOKENS 16384
+
+typedef struct deflate_stream_s deflate_stream_t;
+
+struct deflate_stream_s {
+    // History followed by the data currently being compressed. Matches can
+    // refer back up to DEFLATE_WINDOW_SIZE bytes, including into data from
+    // earlier calls, which is what makes a long-lived stream worthwhile.
+    byte *window;
+    int window_end;
+
+    // Hash chains over 3-byte prefixes. Both store window positions plus
+    // one so that zero can mean "no entry".
+    int *head;
+    int *prev;
+    int hashed_upto;
+
+    // A distance that's tried before anything on the hash chains, or 0 for
+    // none. See DEFLATE_SetRepeatDistance.
+    int repeat_distance;
+
+    // LZ77 output for the block being built. Literals have a distance of 0.
+    uint16_t *token_value;
+    uint16_t *token_dist;
+    int token_count;
+    int block_start;
+
+    // Output bit buffer. DEFLATE packs bits starting with the least
+    // significant bit of each byte.
+    byte *out;
+    int out_pos;
+    uint32_t bit_buffer;
+    int bit_count;
+
+    // Whether the zlib header has been written since the last reset
+    boolean started;
+};
+
+// Upper bound on the output of DEFLATE_Compress for len bytes of input.
+#define DEFLATE_BOUND(len) ((len) + ((len) >> 10) * 5 + 64)
+
+void DEFLATE_Init(deflate_stream_t *stream);
+void DEFLATE_Free(deflate_stream_t *stream);
+
+// Forgets all history; the next call to DEFLATE_Compress starts a new
+// zlib stream.
+void DEFLATE_Reset(deflate_stream_t *stream);
+
+// Hints that the next input is likely to repeat data from the given
+// distance back in the stream, such as a caller that sends the same region
+// over and over. Long runs at that distance are found even when the hash
+// chains are too crowded to reach them. Zero turns the hint off.
+void DEFLATE_SetRepeatDistance(deflate_stream_t *stream, int distance);
+
+// Compresses the input onto the end of the stream and sync-flushes it, so
+// that the receiver can decompress everything written so far without the
+// stream being finished. Returns the number of bytes written to out, which
+// must be able to hold DEFLATE_BOUND(len) bytes.
+int DEFLATE_Compress(deflate_stream_t *stream, const byte *in, int len,
+                     byte *out);
+
+// Like DEFLATE_Compress, but writes the input as stored blocks without
+// looking for matches, for when time matters more than size. The input still
+// becomes part of the stream's history for later calls to refer back to.
+int DEFLATE_Store(deflate_stream_t *stream, const byte *in, int len,
+                  byte *out);
+
+#endif /* #ifndef __DEFLATE_H__ */
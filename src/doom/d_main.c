@@ -168,6 +168,10 @@ extern  boolean setsizeneeded;
 extern  int             showMessages;
 void R_ExecuteSetViewSize (void);
 
+// With -pipelineview, the view of the game as it was at the end of the
+// last frame, being drawn while this frame's tics run.
+static boolean viewpending;
+
 boolean D_Display (void)
 {
     static  boolean		viewactivestate = false;
@@ -181,6 +185,15 @@ boolean D_Display (void)
     boolean			redrawsbar;
 		
     redrawsbar = false;
+
+    // a view left drawing can only be used if it goes where the last one did
+    if (viewpending
+     && (setsizeneeded || gamestate != wipegamestate
+      || gamestate != GS_LEVEL || automapactive || !gametic))
+    {
+	R_DrawQueued ();
+	viewpending = false;
+    }
     
     // change the view size if needed
     if (setsizeneeded)
@@ -236,7 +249,13 @@ boolean D_Display (void)
     
     // draw the view directly
     if (gamestate == GS_LEVEL && !automapactive && gametic)
-	R_RenderPlayerView (&players[displayplayer]);
+    {
+	if (viewpending)
+	    R_FinishPlayerView ();
+	else
+	    R_RenderPlayerView (&players[displayplayer]);
+	viewpending = false;
+    }
 
     if (gamestate == GS_LEVEL && gametic)
 	HU_Drawer ();
@@ -455,8 +474,22 @@ void D_RunFrame()
         } else {
             // normal update
             I_FinishUpdate ();              // page flip or blit buffer
+
+            // start drawing the next frame's view while its tics run
+            if (pipelineview && gamestate == GS_LEVEL && !automapactive
+             && gametic)
+            {
+                R_StartPlayerView (&players[displayplayer]);
+                viewpending = true;
+            }
         }
     }
+    else if (viewpending)
+    {
+        // too old to show by the next time there's a frame
+        R_DrawQueued ();
+        viewpending = false;
+    }
 }
 
 //
@@ -25,6 +25,7 @@
 #include "deh_main.h"
 #include "i_system.h"
 #include "i_swap.h"
+#include "i_video.h"
 #include "z_zone.h"
 #include "v_video.h"
 #include "w_wad.h"
@@ -613,6 +614,7 @@ void F_BunnyScroll (void)
     char	name[10];
     int		stage;
     static int	laststage;
+    static int	lastscrolled = -1;
 		
     p1 = W_CacheLumpName (DEH_String("PFUB2"), PU_LEVEL);
     p2 = W_CacheLumpName (DEH_String("PFUB1"), PU_LEVEL);
@@ -624,6 +626,11 @@ void F_BunnyScroll (void)
 	scrolled = SCREENWIDTH;
     if (scrolled < 0)
 	scrolled = 0;
+
+    // the picture slides right as it scrolls
+    if (lastscrolled != -1 && scrolled != lastscrolled)
+	I_MoveRect(0, 0, SCREENWIDTH, SCREENHEIGHT, lastscrolled - scrolled, 0);
+    lastscrolled = scrolled;
 		
     for ( x=0 ; x<SCREENWIDTH ; x++)
     {
@@ -128,6 +128,7 @@ wipe_exitColorXForm
 
 
 static int*	y;
+static int*	y_prev;
 
 int
 wipe_initMelt
@@ -148,6 +149,7 @@ wipe_initMelt
     // setup initial column positions
     // (y<0 => not ready to scroll yet)
     y = (int *) Z_Malloc(width*sizeof(int), PU_STATIC, 0);
+    y_prev = (int *) Z_Malloc(width*sizeof(int), PU_STATIC, 0);
     y[0] = -(M_Random()%16);
     for (i=1;i<width;i++)
     {
@@ -160,6 +162,46 @@ wipe_initMelt
     return 0;
 }
 
+//
+// Tell the video code how far each run of columns moving at the same
+// speed has slid down, so the part of the start screen they still
+// show can be copied rather than sent again.
+//
+static void
+wipe_hintMelt
+( int	width,
+  int	height )
+{
+    int		i;
+    int		start;
+    int		top;
+    int		dy;
+
+    for (i=0;i<width;)
+    {
+	dy = (y[i] < 0 ? 0 : y[i]) - (y_prev[i] < 0 ? 0 : y_prev[i]);
+	if (dy <= 0)
+	{
+	    i++;
+	    continue;
+	}
+
+	// only the rows every column in the run still has can be copied
+	start = i;
+	top = y[i];
+	for (i++;i<width;i++)
+	{
+	    if ((y[i] < 0 ? 0 : y[i]) - (y_prev[i] < 0 ? 0 : y_prev[i]) != dy)
+		break;
+	    if (y[i] > top)
+		top = y[i];
+	}
+
+	if (top < height)
+	    I_MoveRect(start*2, top-dy, (i-start)*2, height-top, 0, dy);
+    }
+}
+
 int
 wipe_doMelt
 ( int	width,
@@ -177,6 +219,8 @@ wipe_doMelt
 
     width/=2;
 
+    memcpy(y_prev, y, width*sizeof(int));
+
     while (ticks--)
     {
 	for (i=0;i<width;i++)
@@ -211,6 +255,8 @@ wipe_doMelt
 	}
     }
 
+    wipe_hintMelt(width, height);
+
     return done;
 
 }
@@ -222,6 +268,7 @@ wipe_exitMelt
   int	ticks )
 {
     Z_Free(y);
+    Z_Free(y_prev);
     Z_Free(wipe_scr_start);
     Z_Free(wipe_scr_end);
     return 0;
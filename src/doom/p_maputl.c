@@ -673,6 +673,50 @@ boolean PIT_AddThingIntercepts (mobj_t* thing)
 }
 
 
+//
+// Intercepts are taken nearest first, and in the order they were added
+// when they're the same distance away, which is the order vanilla's
+// search for the nearest one found them in. Keeping them in a heap
+// saves searching all of them again for each one.
+//
+static intercept_t*	interceptheap[MAXINTERCEPTS];
+
+static boolean InterceptBefore (intercept_t* a, intercept_t* b)
+{
+    return a->frac < b->frac || (a->frac == b->frac && a < b);
+}
+
+static void SiftDownIntercept (int i, int count)
+{
+    intercept_t*	in;
+    int			child;
+
+    in = interceptheap[i];
+
+    for (;;)
+    {
+	child = i * 2 + 1;
+
+	if (child >= count)
+	    break;
+
+	if (child + 1 < count
+	 && InterceptBefore (interceptheap[child + 1], interceptheap[child]))
+	{
+	    child++;
+	}
+
+	if (!InterceptBefore (interceptheap[child], in))
+	    break;
+
+	interceptheap[i] = interceptheap[child];
+	i = child;
+    }
+
+    interceptheap[i] = in;
+}
+
+
 //
 // P_TraverseIntercepts
 // Returns true if the traverser function returns true
@@ -684,45 +728,35 @@ P_TraverseIntercepts
   fixed_t	maxfrac )
 {
     int			count;
-    fixed_t		dist;
-    intercept_t*	scan;
+    int			i;
     intercept_t*	in;
 	
     count = intercept_p - intercepts;
-    
-    in = 0;			// shut up compiler warning
+
+    // past here the intercepts have already overrun their array
+    if (count > MAXINTERCEPTS)
+	count = MAXINTERCEPTS;
+
+    for (i = 0 ; i < count ; i++)
+	interceptheap[i] = &intercepts[i];
+
+    for (i = count / 2 - 1 ; i >= 0 ; i--)
+	SiftDownIntercept (i, count);
 	
-    while (count--)
+    while (count > 0)
     {
-	dist = INT_MAX;
-	for (scan = intercepts ; scan<intercept_p ; scan++)
-	{
-	    if (scan->frac < dist)
-	    {
-		dist = scan->frac;
-		in = scan;
-	    }
-	}
+	in = interceptheap[0];
 	
-	if (dist > maxfrac)
+	if (in->frac > maxfrac)
 	    return true;	// checked everything in range		
 
-#if 0  // UNUSED
-    {
-	// don't check these yet, there may be others inserted
-	in = scan = intercepts;
-	for ( scan = intercepts ; scan<intercept_p ; scan++)
-	    if (scan->frac > maxfrac)
-		*in++ = *scan;
-	intercept_p = in;
-	return false;
-    }
-#endif
-
         if ( !func (in) )
 	    return false;	// don't bother going farther
 
 	in->frac = INT_MAX;
+
+	interceptheap[0] = interceptheap[--count];
+	SiftDownIntercept (0, count);
     }
 	
     return true;		// everything was traversed
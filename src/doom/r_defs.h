@@ -420,13 +420,16 @@ typedef struct
 //
 // Now what is a visplane, anyway?
 // 
-typedef struct
+typedef struct visplane_s
 {
   fixed_t		height;
   int			picnum;
   int			lightlevel;
   int			minx;
   int			maxx;
+
+  // Next plane in the same R_FindPlane hash chain.
+  struct visplane_s*	next;
   
   // leave pads for [minx-1]/[maxx+1]
   
@@ -21,6 +21,9 @@
 
 
 
+#include <stdlib.h>
+#include <pthread.h>
+
 #include "doomdef.h"
 #include "deh_main.h"
 
@@ -36,6 +39,14 @@
 // State.
 #include "doomstat.h"
 
+#ifdef HAVE_AVX2_DRAWERS
+#include <immintrin.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 
 // ?
 #define MAXWIDTH			1120
@@ -79,19 +90,332 @@ static pixel_t *background_buffer = NULL;
 // R_DrawColumn
 // Source is the top of the column to scale.
 //
-lighttable_t*		dc_colormap; 
-int			dc_x; 
-int			dc_yl; 
-int			dc_yh; 
-fixed_t			dc_iscale; 
-fixed_t			dc_texturemid;
+THREADLOCAL lighttable_t*		dc_colormap; 
+THREADLOCAL int			dc_x; 
+THREADLOCAL int			dc_yl; 
+THREADLOCAL int			dc_yh; 
+THREADLOCAL fixed_t			dc_iscale; 
+THREADLOCAL fixed_t			dc_texturemid;
 
 // first pixel in a column (possibly virtual) 
-byte*			dc_source;		
+THREADLOCAL byte*			dc_source;		
 
 // just for profiling 
 int			dccount;
 
+//
+// Columns are drawn four at a time.
+// Walls and sprites come a column at a time, and drawing a column
+//  straight down the screen touches a new cache line for every pixel.
+//  Instead R_DrawColumn holds on to columns while they fall within
+//  four pixels of each other, and R_FlushColumns draws them a row at
+//  a time, four pixels side by side, where they line up.
+// Each column still steps through its own texture with its own light
+//  level exactly as it would have. Several can share an x, like the
+//  upper and lower parts of a wall or the posts of a sprite, as long
+//  as they don't overlap. Anything else that draws has to wait until
+//  the columns before it are on the screen, so the other drawers flush
+//  first, and so does anything purging the textures they point into.
+//
+#define BATCHCOLUMNS	4
+#define MAXBATCHED	(BATCHCOLUMNS*2)
+
+typedef struct
+{
+    // Which of the four pixel columns it's in.
+    int			slot;
+
+    int			yl;
+    int			yh;
+    byte*		source;
+    lighttable_t*	colormap;
+
+    // For the next row to be drawn.
+    fixed_t		frac;
+    fixed_t		fracstep;
+} batchcolumn_t;
+
+static THREADLOCAL batchcolumn_t	batched[MAXBATCHED];
+static THREADLOCAL int			numbatched;
+
+// The x of the leftmost pixel column.
+static THREADLOCAL int			batchx;
+
+// Whether the columns held are low detail, two pixels wide.
+static THREADLOCAL boolean		batchlow;
+
+// The rightmost pixel column with anything in it. Columns usually come
+//  left to right, and can't overlap one further right than that.
+static THREADLOCAL int			batchlastslot;
+
+
+//
+// DrawBatchedRows
+// Draws rows yl to yh of one column, which must be
+//  the next rows it has to draw.
+//
+static void DrawBatchedRows (batchcolumn_t* c, int yl, int yh)
+{
+    pixel_t*		dest;
+    byte*		source;
+    lighttable_t*	colormap;
+    fixed_t		frac;
+    fixed_t		fracstep;
+    int			y;
+
+    if (yl > yh)
+	return;
+
+    source = c->source;
+    colormap = c->colormap;
+    frac = c->frac;
+    fracstep = c->fracstep;
+
+    if (batchlow)
+    {
+	dest = ylookup[yl] + columnofs[(batchx + c->slot) << 1];
+
+	for (y = yl; y <= yh; y++)
+	{
+	    dest[0] = dest[1] = colormap[source[(frac>>FRACBITS)&127]];
+	    dest += SCREENWIDTH;
+	    frac += fracstep;
+	}
+    }
+    else
+    {
+	// Framebuffer destination address.
+	// Use ylookup LUT to avoid multiply with ScreenWidth.
+	// Use columnofs LUT for subwindows? 
+	dest = ylookup[yl] + columnofs[batchx + c->slot];
+
+	// Inner loop that does the actual texture mapping,
+	//  e.g. a DDA-lile scaling.
+	for (y = yl; y <= yh; y++)
+	{
+	    // Re-map color indices from wall texture column
+	    //  using a lighting/special effects LUT.
+	    *dest = colormap[source[(frac>>FRACBITS)&127]];
+	    dest += SCREENWIDTH;
+	    frac += fracstep;
+	}
+    }
+
+    c->frac = frac;
+}
+
+//
+// DrawQuadRows
+// Draws rows yl to yh of four columns side by side.
+//
+static void DrawQuadRows (batchcolumn_t** quad, int yl, int yh)
+{
+    pixel_t*		dest;
+    byte		*source0, *source1, *source2, *source3;
+    lighttable_t	*colormap0, *colormap1, *colormap2, *colormap3;
+    fixed_t		frac0, frac1, frac2, frac3;
+    fixed_t		fracstep0, fracstep1, fracstep2, fracstep3;
+    int			count;
+
+    source0 = quad[0]->source;
+    source1 = quad[1]->source;
+    source2 = quad[2]->source;
+    source3 = quad[3]->source;
+    colormap0 = quad[0]->colormap;
+    colormap1 = quad[1]->colormap;
+    colormap2 = quad[2]->colormap;
+    colormap3 = quad[3]->colormap;
+    frac0 = quad[0]->frac;
+    frac1 = quad[1]->frac;
+    frac2 = quad[2]->frac;
+    frac3 = quad[3]->frac;
+    fracstep0 = quad[0]->fracstep;
+    fracstep1 = quad[1]->fracstep;
+    fracstep2 = quad[2]->fracstep;
+    fracstep3 = quad[3]->fracstep;
+
+    count = yh - yl;
+
+    if (batchlow)
+    {
+	dest = ylookup[yl] + columnofs[batchx << 1];
+
+	do
+	{
+	    dest[0] = dest[1] = colormap0[source0[(frac0>>FRACBITS)&127]];
+	    dest[2] = dest[3] = colormap1[source1[(frac1>>FRACBITS)&127]];
+	    dest[4] = dest[5] = colormap2[source2[(frac2>>FRACBITS)&127]];
+	    dest[6] = dest[7] = colormap3[source3[(frac3>>FRACBITS)&127]];
+	    dest += SCREENWIDTH;
+	    frac0 += fracstep0;
+	    frac1 += fracstep1;
+	    frac2 += fracstep2;
+	    frac3 += fracstep3;
+	} while (count--);
+    }
+    else
+    {
+	dest = ylookup[yl] + columnofs[batchx];
+
+	do
+	{
+	    dest[0] = colormap0[source0[(frac0>>FRACBITS)&127]];
+	    dest[1] = colormap1[source1[(frac1>>FRACBITS)&127]];
+	    dest[2] = colormap2[source2[(frac2>>FRACBITS)&127]];
+	    dest[3] = colormap3[source3[(frac3>>FRACBITS)&127]];
+	    dest += SCREENWIDTH;
+	    frac0 += fracstep0;
+	    frac1 += fracstep1;
+	    frac2 += fracstep2;
+	    frac3 += fracstep3;
+	} while (count--);
+    }
+
+    quad[0]->frac = frac0;
+    quad[1]->frac = frac1;
+    quad[2]->frac = frac2;
+    quad[3]->frac = frac3;
+}
+
+void R_FlushColumns (void)
+{
+    batchcolumn_t*	inslot[BATCHCOLUMNS][MAXBATCHED];
+    batchcolumn_t*	quad[BATCHCOLUMNS];
+    int			numinslot[BATCHCOLUMNS];
+    int			numquads;
+    int			top;
+    int			bottom;
+    int			slot;
+    int			i;
+
+    if (!numbatched)
+	return;
+
+    for (slot = 0; slot < BATCHCOLUMNS; slot++)
+	numinslot[slot] = 0;
+
+    for (i = 0; i < numbatched; i++)
+    {
+	slot = batched[i].slot;
+	inslot[slot][numinslot[slot]++] = &batched[i];
+    }
+
+    numquads = numinslot[0];
+
+    for (slot = 1; slot < BATCHCOLUMNS; slot++)
+    {
+	if (numinslot[slot] < numquads)
+	    numquads = numinslot[slot];
+    }
+
+    // Take one column from each pixel column at a time, in the order
+    //  they came, and draw the rows they all share together.
+    for (i = 0; i < numquads; i++)
+    {
+	for (slot = 0; slot < BATCHCOLUMNS; slot++)
+	    quad[slot] = inslot[slot][i];
+
+	top = quad[0]->yl;
+	bottom = quad[0]->yh;
+
+	for (slot = 1; slot < BATCHCOLUMNS; slot++)
+	{
+	    if (quad[slot]->yl > top)
+		top = quad[slot]->yl;
+	    if (quad[slot]->yh < bottom)
+		bottom = quad[slot]->yh;
+	}
+
+	if (top > bottom)
+	{
+	    for (slot = 0; slot < BATCHCOLUMNS; slot++)
+		DrawBatchedRows (quad[slot], quad[slot]->yl, quad[slot]->yh);
+
+	    continue;
+	}
+
+	for (slot = 0; slot < BATCHCOLUMNS; slot++)
+	    DrawBatchedRows (quad[slot], quad[slot]->yl, top - 1);
+
+	DrawQuadRows (quad, top, bottom);
+
+	for (slot = 0; slot < BATCHCOLUMNS; slot++)
+	    DrawBatchedRows (quad[slot], bottom + 1, quad[slot]->yh);
+    }
+
+    // The rest are drawn on their own.
+    for (slot = 0; slot < BATCHCOLUMNS; slot++)
+    {
+	for (i = numquads; i < numinslot[slot]; i++)
+	    DrawBatchedRows (inslot[slot][i], inslot[slot][i]->yl, inslot[slot][i]->yh);
+    }
+
+    numbatched = 0;
+}
+
+//
+// BatchColumn
+// Holds on to the column in the dc_* variables,
+//  drawing what's held first if it doesn't fit.
+//
+static void BatchColumn (boolean low)
+{
+    batchcolumn_t*	c;
+    int			slot;
+    int			i;
+
+    slot = dc_x - batchx;
+
+    if (numbatched)
+    {
+	if (low != batchlow
+	    || slot < 0
+	    || slot >= BATCHCOLUMNS)
+	{
+	    R_FlushColumns ();
+	}
+	else if (slot <= batchlastslot)
+	{
+	    for (i = 0; i < numbatched; i++)
+	    {
+		if (batched[i].slot == slot
+		    && batched[i].yl <= dc_yh
+		    && batched[i].yh >= dc_yl)
+		{
+		    R_FlushColumns ();
+		    break;
+		}
+	    }
+	}
+    }
+
+    if (!numbatched)
+    {
+	batchx = dc_x;
+	batchlow = low;
+	slot = 0;
+    }
+
+    if (!numbatched || slot > batchlastslot)
+	batchlastslot = slot;
+
+    c = &batched[numbatched++];
+    c->slot = slot;
+    c->yl = dc_yl;
+    c->yh = dc_yh;
+    c->source = dc_source;
+    c->colormap = dc_colormap;
+
+    // Determine scaling,
+    //  which is the only mapping to be done.
+    c->fracstep = dc_iscale;
+    c->frac = dc_texturemid + (dc_yl-centery)*dc_iscale;
+
+    if (numbatched == MAXBATCHED)
+	R_FlushColumns ();
+}
+
+
 //
 // A column is a vertical slice/span from a wall texture that,
 //  given the DOOM style restrictions on the view orientation,
@@ -102,9 +426,6 @@ int			dccount;
 void R_DrawColumn (void) 
 { 
     int			count; 
-    pixel_t*		dest;
-    fixed_t		frac;
-    fixed_t		fracstep;	 
  
     count = dc_yh - dc_yl; 
 
@@ -119,29 +440,8 @@ void R_DrawColumn (void)
 	I_Error ("R_DrawColumn: %i to %i at %i", dc_yl, dc_yh, dc_x); 
 #endif 
 
-    // Framebuffer destination address.
-    // Use ylookup LUT to avoid multiply with ScreenWidth.
-    // Use columnofs LUT for subwindows? 
-    dest = ylookup[dc_yl] + columnofs[dc_x];  
-
-    // Determine scaling,
-    //  which is the only mapping to be done.
-    fracstep = dc_iscale; 
-    frac = dc_texturemid + (dc_yl-centery)*fracstep; 
-
-    // Inner loop that does the actual texture mapping,
-    //  e.g. a DDA-lile scaling.
-    // This is as fast as it gets.
-    do 
-    {
-	// Re-map color indices from wall texture column
-	//  using a lighting/special effects LUT.
-	*dest = dc_colormap[dc_source[(frac>>FRACBITS)&127]];
-	
-	dest += SCREENWIDTH; 
-	frac += fracstep;
-	
-    } while (count--); 
+    // Drawn along with the columns beside it.
+    BatchColumn (false);
 } 
 
 
@@ -208,11 +508,6 @@ void R_DrawColumn (void)
 void R_DrawColumnLow (void) 
 { 
     int			count; 
-    pixel_t*		dest;
-    pixel_t*		dest2;
-    fixed_t		frac;
-    fixed_t		fracstep;	 
-    int                 x;
  
     count = dc_yh - dc_yl; 
 
@@ -230,24 +525,8 @@ void R_DrawColumnLow (void)
     }
     //	dccount++; 
 #endif 
-    // Blocky mode, need to multiply by 2.
-    x = dc_x << 1;
-    
-    dest = ylookup[dc_yl] + columnofs[x];
-    dest2 = ylookup[dc_yl] + columnofs[x+1];
-    
-    fracstep = dc_iscale; 
-    frac = dc_texturemid + (dc_yl-centery)*fracstep;
-    
-    do 
-    {
-	// Hack. Does not work corretly.
-	*dest2 = *dest = dc_colormap[dc_source[(frac>>FRACBITS)&127]];
-	dest += SCREENWIDTH;
-	dest2 += SCREENWIDTH;
-	frac += fracstep; 
-
-    } while (count--);
+    // Blocky mode, R_FlushColumns draws each pixel twice.
+    BatchColumn (true);
 }
 
 
@@ -269,7 +548,7 @@ int	fuzzoffset[FUZZTABLE] =
     FUZZOFF,FUZZOFF,-FUZZOFF,FUZZOFF,FUZZOFF,-FUZZOFF,FUZZOFF 
 }; 
 
-int	fuzzpos = 0; 
+THREADLOCAL int fuzzpos = 0; 
 
 
 //
@@ -287,6 +566,9 @@ void R_DrawFuzzColumn (void)
     fixed_t		frac;
     fixed_t		fracstep;	 
 
+    // Columns held back go first.
+    R_FlushColumns ();
+
     // Adjust borders. Low... 
     if (!dc_yl) 
 	dc_yl = 1;
@@ -348,6 +630,9 @@ void R_DrawFuzzColumnLow (void)
     fixed_t		fracstep;	 
     int x;
 
+    // Columns held back go first.
+    R_FlushColumns ();
+
     // Adjust borders. Low... 
     if (!dc_yl) 
 	dc_yl = 1;
@@ -418,7 +703,7 @@ void R_DrawFuzzColumnLow (void)
 //  of the BaronOfHell, the HellKnight, uses
 //  identical sprites, kinda brightened up.
 //
-byte*	dc_translation;
+THREADLOCAL byte*	dc_translation;
 byte*	translationtables;
 
 void R_DrawTranslatedColumn (void) 
@@ -428,6 +713,9 @@ void R_DrawTranslatedColumn (void)
     fixed_t		frac;
     fixed_t		fracstep;	 
  
+    // Columns held back go first.
+    R_FlushColumns ();
+
     count = dc_yh - dc_yl; 
     if (count < 0) 
 	return; 
@@ -474,6 +762,9 @@ void R_DrawTranslatedColumnLow (void)
     fixed_t		fracstep;	 
     int                 x;
  
+    // Columns held back go first.
+    R_FlushColumns ();
+
     count = dc_yh - dc_yl; 
     if (count < 0) 
 	return; 
@@ -567,19 +858,19 @@ void R_InitTranslationTables (void)
 // In consequence, flats are not stored by column (like walls),
 //  and the inner loop has to step in texture space u and v.
 //
-int			ds_y; 
-int			ds_x1; 
-int			ds_x2;
+THREADLOCAL int			ds_y; 
+THREADLOCAL int			ds_x1; 
+THREADLOCAL int			ds_x2;
 
-lighttable_t*		ds_colormap; 
+THREADLOCAL lighttable_t*		ds_colormap; 
 
-fixed_t			ds_xfrac; 
-fixed_t			ds_yfrac; 
-fixed_t			ds_xstep; 
-fixed_t			ds_ystep;
+THREADLOCAL fixed_t			ds_xfrac; 
+THREADLOCAL fixed_t			ds_yfrac; 
+THREADLOCAL fixed_t			ds_xstep; 
+THREADLOCAL fixed_t			ds_ystep;
 
 // start of a 64*64 tile image 
-byte*			ds_source;	
+THREADLOCAL byte*			ds_source;	
 
 // just for profiling
 int			dscount;
@@ -595,6 +886,9 @@ void R_DrawSpan (void)
     int spot;
     unsigned int xtemp, ytemp;
 
+    // Columns held back go first.
+    R_FlushColumns ();
+
 #ifdef RANGECHECK
     if (ds_x2 < ds_x1
 	|| ds_x1<0
@@ -724,6 +1018,9 @@ void R_DrawSpanLow (void)
     int count;
     int spot;
 
+    // Columns held back go first.
+    R_FlushColumns ();
+
 #ifdef RANGECHECK
     if (ds_x2 < ds_x1
 	|| ds_x1<0
@@ -766,38 +1063,1032 @@ void R_DrawSpanLow (void)
     } while (count--);
 }
 
+
+#ifdef HAVE_AVX2_DRAWERS
+
 //
-// R_InitBuffer 
-// Creats lookup tables that avoid
-//  multiplies and other hazzles
-//  for getting the framebuffer address
-//  of a pixel to draw.
+// The span drawers again, using AVX2 to work out eight pixels at a
+//  time. The position steps are the same 32-bit sums, so the pixels are
+//  the same. Bytes are gathered as the aligned words around them so
+//  that nothing past the end of a flat or colormap is read.
 //
-void
-R_InitBuffer
-( int		width,
-  int		height ) 
-{ 
-    int		i; 
 
-    // Handle resize,
-    //  e.g. smaller view windows
-    //  with border and/or status bar.
-    viewwindowx = (SCREENWIDTH-width) >> 1; 
+static boolean		avx2checked;
+static boolean		avx2;
 
-    // Column offset. For windows.
-    for (i=0 ; i<width ; i++) 
-	columnofs[i] = viewwindowx + i;
+boolean R_HaveAVX2 (void)
+{
+    if (!avx2checked)
+    {
+	avx2 = __builtin_cpu_supports ("avx2");
+	avx2checked = true;
+    }
 
-    // Samw with base row offset.
-    if (width == SCREENWIDTH) 
-	viewwindowy = 0; 
-    else 
-	viewwindowy = (SCREENHEIGHT-SBARHEIGHT-height) >> 1; 
+    return avx2;
+}
 
-    // Preclaculate all row offsets.
-    for (i=0 ; i<height ; i++) 
-	ylookup[i] = I_VideoBuffer + (i+viewwindowy)*SCREENWIDTH; 
+__attribute__((target("avx2")))
+static inline __m256i GatherBytes (const byte* table, __m256i index)
+{
+    __m256i	words;
+    __m256i	shift;
+
+    words = _mm256_i32gather_epi32 ((const int *) table,
+				    _mm256_andnot_si256 (_mm256_set1_epi32 (3),
+							 index),
+				    1);
+    shift = _mm256_slli_epi32 (_mm256_and_si256 (index,
+						 _mm256_set1_epi32 (3)),
+			       3);
+
+    return _mm256_and_si256 (_mm256_srlv_epi32 (words, shift),
+			     _mm256_set1_epi32 (0xff));
+}
+
+// Looks up the next eight pixels of the span, returning them as the low
+//  eight bytes.
+__attribute__((target("avx2")))
+static inline __m128i SpanPixels (__m256i position)
+{
+    __m256i	spot;
+    __m256i	pixels;
+
+    spot = _mm256_or_si256 (_mm256_and_si256 (_mm256_srli_epi32 (position, 4),
+					       _mm256_set1_epi32 (0x0fc0)),
+			    _mm256_srli_epi32 (position, 26));
+
+    pixels = GatherBytes (ds_colormap, GatherBytes (ds_source, spot));
+
+    pixels = _mm256_packus_epi32 (pixels, pixels);
+    pixels = _mm256_packus_epi16 (pixels, pixels);
+
+    return _mm_unpacklo_epi32 (_mm256_castsi256_si128 (pixels),
+			       _mm256_extracti128_si256 (pixels, 1));
+}
+
+__attribute__((target("avx2")))
+void R_DrawSpanAVX2 (void)
+{
+    unsigned int position, step;
+    pixel_t *dest;
+    int count;
+    int spot;
+    unsigned int xtemp, ytemp;
+    __m256i positions, step8;
+
+    // Columns held back go first.
+    R_FlushColumns ();
+
+#ifdef RANGECHECK
+    if (ds_x2 < ds_x1
+	|| ds_x1<0
+	|| ds_x2>=SCREENWIDTH
+	|| (unsigned)ds_y>SCREENHEIGHT)
+    {
+	I_Error( "R_DrawSpan: %i to %i at %i",
+		 ds_x1,ds_x2,ds_y);
+    }
+#endif
+
+    position = ((ds_xfrac << 10) & 0xffff0000)
+             | ((ds_yfrac >> 6)  & 0x0000ffff);
+    step = ((ds_xstep << 10) & 0xffff0000)
+         | ((ds_ystep >> 6)  & 0x0000ffff);
+
+    dest = ylookup[ds_y] + columnofs[ds_x1];
+
+    count = ds_x2 - ds_x1 + 1;
+
+    positions = _mm256_add_epi32 (_mm256_set1_epi32 (position),
+				  _mm256_mullo_epi32 (_mm256_set1_epi32 (step),
+						      _mm256_setr_epi32 (0, 1, 2, 3,
+									 4, 5, 6, 7)));
+    step8 = _mm256_set1_epi32 (step * 8);
+
+    while (count >= 8)
+    {
+	_mm_storel_epi64 ((__m128i *) dest, SpanPixels (positions));
+
+	positions = _mm256_add_epi32 (positions, step8);
+	position += step * 8;
+	dest += 8;
+	count -= 8;
+    }
+
+    while (count-- > 0)
+    {
+        ytemp = (position >> 4) & 0x0fc0;
+        xtemp = (position >> 26);
+        spot = xtemp | ytemp;
+
+	*dest++ = ds_colormap[ds_source[spot]];
+
+        position += step;
+    }
+}
+
+__attribute__((target("avx2")))
+void R_DrawSpanLowAVX2 (void)
+{
+    unsigned int position, step;
+    unsigned int xtemp, ytemp;
+    pixel_t *dest;
+    int count;
+    int spot;
+    __m128i pixels;
+    __m256i positions, step8;
+
+    // Columns held back go first.
+    R_FlushColumns ();
+
+#ifdef RANGECHECK
+    if (ds_x2 < ds_x1
+	|| ds_x1<0
+	|| ds_x2>=SCREENWIDTH
+	|| (unsigned)ds_y>SCREENHEIGHT)
+    {
+	I_Error( "R_DrawSpan: %i to %i at %i",
+		 ds_x1,ds_x2,ds_y);
+    }
+#endif
+
+    position = ((ds_xfrac << 10) & 0xffff0000)
+             | ((ds_yfrac >> 6)  & 0x0000ffff);
+    step = ((ds_xstep << 10) & 0xffff0000)
+         | ((ds_ystep >> 6)  & 0x0000ffff);
+
+    count = ds_x2 - ds_x1 + 1;
+
+    // Blocky mode, need to multiply by 2.
+    ds_x1 <<= 1;
+    ds_x2 <<= 1;
+
+    dest = ylookup[ds_y] + columnofs[ds_x1];
+
+    positions = _mm256_add_epi32 (_mm256_set1_epi32 (position),
+				  _mm256_mullo_epi32 (_mm256_set1_epi32 (step),
+						      _mm256_setr_epi32 (0, 1, 2, 3,
+									 4, 5, 6, 7)));
+    step8 = _mm256_set1_epi32 (step * 8);
+
+    while (count >= 8)
+    {
+	// Each pixel twice.
+	pixels = SpanPixels (positions);
+	_mm_storeu_si128 ((__m128i *) dest, _mm_unpacklo_epi8 (pixels, pixels));
+
+	positions = _mm256_add_epi32 (positions, step8);
+	position += step * 8;
+	dest += 16;
+	count -= 8;
+    }
+
+    while (count-- > 0)
+    {
+        ytemp = (position >> 4) & 0x0fc0;
+        xtemp = (position >> 26);
+        spot = xtemp | ytemp;
+
+	*dest++ = ds_colormap[ds_source[spot]];
+	*dest++ = ds_colormap[ds_source[spot]];
+
+	position += step;
+    }
+}
+
+#endif
+
+//
+// Drawing the view transposed.
+// With -transposeview, the view is drawn into a buffer of its own that
+//  is laid out a column at a time, SCREENHEIGHT pixels to a column. Walls
+//  and sprites run down memory instead of across the screen, and spans
+//  are the ones that stride. R_TransposeView copies the finished view
+//  onto the screen, before the status bar and menus go on top.
+// Only full detail is drawn this way.
+//
+
+static boolean		viewtransposed;
+static pixel_t		transposedview[SCREENWIDTH*SCREENHEIGHT];
+
+// fuzzoffset, with a row one pixel away.
+static int		transposedfuzzoffset[FUZZTABLE];
+
+
+void R_DrawColumnTransposed (void) 
+{ 
+    int			count; 
+    pixel_t*		dest;
+    fixed_t		frac;
+    fixed_t		fracstep;	 
+    byte*		source;
+    lighttable_t*	colormap;
+ 
+    count = dc_yh - dc_yl; 
+
+    // Zero length, column does not exceed a pixel.
+    if (count < 0) 
+	return; 
+				 
+#ifdef RANGECHECK 
+    if ((unsigned)dc_x >= SCREENWIDTH
+	|| dc_yl < 0
+	|| dc_yh >= SCREENHEIGHT) 
+	I_Error ("R_DrawColumn: %i to %i at %i", dc_yl, dc_yh, dc_x); 
+#endif 
+
+    dest = ylookup[dc_yl] + columnofs[dc_x];  
+    source = dc_source;
+    colormap = dc_colormap;
+
+    fracstep = dc_iscale; 
+    frac = dc_texturemid + (dc_yl-centery)*fracstep; 
+
+    // Contiguous now, so four pixels at a time.
+    while (count >= 3)
+    {
+	dest[0] = colormap[source[(frac>>FRACBITS)&127]];
+	frac += fracstep;
+	dest[1] = colormap[source[(frac>>FRACBITS)&127]];
+	frac += fracstep;
+	dest[2] = colormap[source[(frac>>FRACBITS)&127]];
+	frac += fracstep;
+	dest[3] = colormap[source[(frac>>FRACBITS)&127]];
+	frac += fracstep;
+	dest += 4;
+	count -= 4;
+    }
+
+    while (count-- >= 0)
+    {
+	*dest++ = colormap[source[(frac>>FRACBITS)&127]];
+	frac += fracstep;
+    }
+} 
+
+void R_DrawFuzzColumnTransposed (void) 
+{ 
+    int			count; 
+    pixel_t*		dest;
+
+    // Adjust borders. Low... 
+    if (!dc_yl) 
+	dc_yl = 1;
+
+    // .. and high.
+    if (dc_yh == viewheight-1) 
+	dc_yh = viewheight - 2; 
+		 
+    count = dc_yh - dc_yl; 
+
+    // Zero length.
+    if (count < 0) 
+	return; 
+
+#ifdef RANGECHECK 
+    if ((unsigned)dc_x >= SCREENWIDTH
+	|| dc_yl < 0 || dc_yh >= SCREENHEIGHT)
+    {
+	I_Error ("R_DrawFuzzColumn: %i to %i at %i",
+		 dc_yl, dc_yh, dc_x);
+    }
+#endif
+    
+    dest = ylookup[dc_yl] + columnofs[dc_x];
+
+    do 
+    {
+	*dest = colormaps[6*256+dest[transposedfuzzoffset[fuzzpos]]]; 
+
+	// Clamp table lookup index.
+	if (++fuzzpos == FUZZTABLE) 
+	    fuzzpos = 0;
+	
+	dest++;
+    } while (count--); 
+} 
+
+void R_DrawTranslatedColumnTransposed (void) 
+{ 
+    int			count; 
+    pixel_t*		dest;
+    fixed_t		frac;
+    fixed_t		fracstep;	 
+ 
+    count = dc_yh - dc_yl; 
+    if (count < 0) 
+	return; 
+				 
+#ifdef RANGECHECK 
+    if ((unsigned)dc_x >= SCREENWIDTH
+	|| dc_yl < 0
+	|| dc_yh >= SCREENHEIGHT)
+    {
+	I_Error ( "R_DrawColumn: %i to %i at %i",
+		  dc_yl, dc_yh, dc_x);
+    }
+#endif 
+
+    dest = ylookup[dc_yl] + columnofs[dc_x]; 
+
+    fracstep = dc_iscale; 
+    frac = dc_texturemid + (dc_yl-centery)*fracstep; 
+
+    do 
+    {
+	*dest++ = dc_colormap[dc_translation[dc_source[frac>>FRACBITS]]];
+	frac += fracstep; 
+    } while (count--); 
+}
+
+void R_DrawSpanTransposed (void) 
+{ 
+    unsigned int position, step;
+    pixel_t *dest;
+    int count;
+    int spot;
+    unsigned int xtemp, ytemp;
+
+#ifdef RANGECHECK
+    if (ds_x2 < ds_x1
+	|| ds_x1<0
+	|| ds_x2>=SCREENWIDTH
+	|| (unsigned)ds_y>SCREENHEIGHT)
+    {
+	I_Error( "R_DrawSpan: %i to %i at %i",
+		 ds_x1,ds_x2,ds_y);
+    }
+#endif
+
+    position = ((ds_xfrac << 10) & 0xffff0000)
+             | ((ds_yfrac >> 6)  & 0x0000ffff);
+    step = ((ds_xstep << 10) & 0xffff0000)
+         | ((ds_ystep >> 6)  & 0x0000ffff);
+
+    dest = ylookup[ds_y] + columnofs[ds_x1];
+    count = ds_x2 - ds_x1;
+
+    do
+    {
+        ytemp = (position >> 4) & 0x0fc0;
+        xtemp = (position >> 26);
+        spot = xtemp | ytemp;
+
+	*dest = ds_colormap[ds_source[spot]];
+	dest += SCREENHEIGHT;
+
+        position += step;
+
+    } while (count--);
+}
+
+
+#ifdef __SSE2__
+
+//
+// TransposeTile
+// Copies 16 columns of 16 pixels from the transposed view
+//  into 16 rows of the screen.
+// Four passes interleaving bytes from pairs of registers transpose
+//  them, if the registers are loaded and stored in bit reversed order.
+//
+#define INTERLEAVE(a, b) \
+    b[0] = _mm_unpacklo_epi8 (a[0], a[1]); \
+    b[8] = _mm_unpackhi_epi8 (a[0], a[1]); \
+    b[1] = _mm_unpacklo_epi8 (a[2], a[3]); \
+    b[9] = _mm_unpackhi_epi8 (a[2], a[3]); \
+    b[2] = _mm_unpacklo_epi8 (a[4], a[5]); \
+    b[10] = _mm_unpackhi_epi8 (a[4], a[5]); \
+    b[3] = _mm_unpacklo_epi8 (a[6], a[7]); \
+    b[11] = _mm_unpackhi_epi8 (a[6], a[7]); \
+    b[4] = _mm_unpacklo_epi8 (a[8], a[9]); \
+    b[12] = _mm_unpackhi_epi8 (a[8], a[9]); \
+    b[5] = _mm_unpacklo_epi8 (a[10], a[11]); \
+    b[13] = _mm_unpackhi_epi8 (a[10], a[11]); \
+    b[6] = _mm_unpacklo_epi8 (a[12], a[13]); \
+    b[14] = _mm_unpackhi_epi8 (a[12], a[13]); \
+    b[7] = _mm_unpacklo_epi8 (a[14], a[15]); \
+    b[15] = _mm_unpackhi_epi8 (a[14], a[15]);
+
+static void TransposeTile (pixel_t* source, pixel_t* dest)
+{
+    __m128i	a[16];
+    __m128i	b[16];
+
+    a[0] = _mm_loadu_si128 ((__m128i*) (source + 0*SCREENHEIGHT));
+    a[1] = _mm_loadu_si128 ((__m128i*) (source + 8*SCREENHEIGHT));
+    a[2] = _mm_loadu_si128 ((__m128i*) (source + 4*SCREENHEIGHT));
+    a[3] = _mm_loadu_si128 ((__m128i*) (source + 12*SCREENHEIGHT));
+    a[4] = _mm_loadu_si128 ((__m128i*) (source + 2*SCREENHEIGHT));
+    a[5] = _mm_loadu_si128 ((__m128i*) (source + 10*SCREENHEIGHT));
+    a[6] = _mm_loadu_si128 ((__m128i*) (source + 6*SCREENHEIGHT));
+    a[7] = _mm_loadu_si128 ((__m128i*) (source + 14*SCREENHEIGHT));
+    a[8] = _mm_loadu_si128 ((__m128i*) (source + 1*SCREENHEIGHT));
+    a[9] = _mm_loadu_si128 ((__m128i*) (source + 9*SCREENHEIGHT));
+    a[10] = _mm_loadu_si128 ((__m128i*) (source + 5*SCREENHEIGHT));
+    a[11] = _mm_loadu_si128 ((__m128i*) (source + 13*SCREENHEIGHT));
+    a[12] = _mm_loadu_si128 ((__m128i*) (source + 3*SCREENHEIGHT));
+    a[13] = _mm_loadu_si128 ((__m128i*) (source + 11*SCREENHEIGHT));
+    a[14] = _mm_loadu_si128 ((__m128i*) (source + 7*SCREENHEIGHT));
+    a[15] = _mm_loadu_si128 ((__m128i*) (source + 15*SCREENHEIGHT));
+
+    INTERLEAVE (a, b);
+    INTERLEAVE (b, a);
+    INTERLEAVE (a, b);
+    INTERLEAVE (b, a);
+
+    _mm_storeu_si128 ((__m128i*) (dest + 0*SCREENWIDTH), a[0]);
+    _mm_storeu_si128 ((__m128i*) (dest + 8*SCREENWIDTH), a[1]);
+    _mm_storeu_si128 ((__m128i*) (dest + 4*SCREENWIDTH), a[2]);
+    _mm_storeu_si128 ((__m128i*) (dest + 12*SCREENWIDTH), a[3]);
+    _mm_storeu_si128 ((__m128i*) (dest + 2*SCREENWIDTH), a[4]);
+    _mm_storeu_si128 ((__m128i*) (dest + 10*SCREENWIDTH), a[5]);
+    _mm_storeu_si128 ((__m128i*) (dest + 6*SCREENWIDTH), a[6]);
+    _mm_storeu_si128 ((__m128i*) (dest + 14*SCREENWIDTH), a[7]);
+    _mm_storeu_si128 ((__m128i*) (dest + 1*SCREENWIDTH), a[8]);
+    _mm_storeu_si128 ((__m128i*) (dest + 9*SCREENWIDTH), a[9]);
+    _mm_storeu_si128 ((__m128i*) (dest + 5*SCREENWIDTH), a[10]);
+    _mm_storeu_si128 ((__m128i*) (dest + 13*SCREENWIDTH), a[11]);
+    _mm_storeu_si128 ((__m128i*) (dest + 3*SCREENWIDTH), a[12]);
+    _mm_storeu_si128 ((__m128i*) (dest + 11*SCREENWIDTH), a[13]);
+    _mm_storeu_si128 ((__m128i*) (dest + 7*SCREENWIDTH), a[14]);
+    _mm_storeu_si128 ((__m128i*) (dest + 15*SCREENWIDTH), a[15]);
+}
+
+#else
+
+static void TransposeTile (pixel_t* source, pixel_t* dest)
+{
+    int		x;
+    int		y;
+
+    for (y = 0; y < 16; y++)
+    {
+	for (x = 0; x < 16; x++)
+	    dest[y*SCREENWIDTH + x] = source[x*SCREENHEIGHT + y];
+    }
+}
+
+#endif
+
+
+//
+// R_TransposeView
+// Copies the view onto the screen if it was drawn transposed,
+//  in tiles of 16 by 16 pixels so that both sides stay in cache.
+//
+void R_TransposeView (void)
+{
+    pixel_t*	screen;
+    int		x;
+    int		y;
+    int		i;
+    int		tileheight;
+
+    if (!viewtransposed)
+	return;
+
+    screen = I_VideoBuffer + viewwindowy*SCREENWIDTH + viewwindowx;
+
+    // The view is always a multiple of 16 wide,
+    //  but can be only a multiple of 8 high.
+    tileheight = viewheight & ~15;
+
+    for (x = 0; x < viewwidth; x += 16)
+    {
+	for (y = 0; y < tileheight; y += 16)
+	{
+	    TransposeTile (transposedview + x*SCREENHEIGHT + y,
+			   screen + y*SCREENWIDTH + x);
+	}
+
+	for (y = tileheight; y < viewheight; y++)
+	{
+	    for (i = 0; i < 16; i++)
+		screen[y*SCREENWIDTH + x + i]
+		    = transposedview[(x + i)*SCREENHEIGHT + y];
+	}
+    }
+}
+
+//
+// R_SetTransposedView
+// Whether to draw the view transposed from the next R_InitBuffer.
+//
+void R_SetTransposedView (boolean transposed)
+{
+    int		i;
+
+    viewtransposed = transposed;
+
+    for (i = 0; i < FUZZTABLE; i++)
+	transposedfuzzoffset[i] = fuzzoffset[i] > 0 ? 1 : -1;
+}
+
+//
+// Drawing on threads.
+// The refresh works out every column and span of the view on the main
+//  thread, but in threaded mode the drawing functions only queue them
+//  up. R_DrawQueued then draws the lot, with each thread taking a strip
+//  of the view. Everything that touches a pixel is in that pixel's
+//  column, so each strip can draw its queue in order and the result is
+//  the same as drawing as we went.
+// The queue only holds what's needed to draw, not the game state it
+//  came from, so R_StartQueued can leave the threads drawing while the
+//  game moves on.
+//
+
+typedef struct
+{
+    void		(*func) (void);
+    boolean		span;
+
+    lighttable_t*	colormap;
+    byte*		source;
+
+    // Columns.
+    int			x;
+    int			yl;
+    int			yh;
+    fixed_t		iscale;
+    fixed_t		texturemid;
+    byte*		translation;
+    int			fuzzpos;
+
+    // Spans.
+    int			y;
+    int			x1;
+    int			x2;
+    fixed_t		xfrac;
+    fixed_t		yfrac;
+    fixed_t		xstep;
+    fixed_t		ystep;
+} drawcall_t;
+
+typedef struct
+{
+    drawcall_t*		calls;
+    int			numcalls;
+    int			maxcalls;
+} drawstrip_t;
+
+int			numdrawthreads = 1;
+
+static drawstrip_t*	drawstrips;
+
+// Threads other than this one drawing strips. If there are as many as
+//  strips, this thread doesn't draw any.
+static int		numdrawworkers;
+
+// Whether R_StartQueued has left the threads drawing.
+static boolean		drawsinflight;
+
+// The drawing functions that the queueing ones stand in for.
+static void		(*drawcolumn) (void);
+static void		(*drawfuzzcolumn) (void);
+static void		(*drawtranscolumn) (void);
+static void		(*drawspan) (void);
+
+// The threads wait for drawgeneration to change, then draw their
+//  strip and count down drawsleft.
+static pthread_mutex_t	drawlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	drawstart = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	drawdone = PTHREAD_COND_INITIALIZER;
+static unsigned int	drawgeneration;
+static int		drawsleft;
+
+
+static int StripStart (int strip)
+{
+    return (viewwidth * strip + numdrawthreads - 1) / numdrawthreads;
+}
+
+static drawcall_t* NewDrawCall (int strip)
+{
+    drawstrip_t*	s;
+
+    s = &drawstrips[strip];
+
+    if (s->numcalls == s->maxcalls)
+    {
+	s->maxcalls = s->maxcalls ? s->maxcalls * 2 : 1024;
+	s->calls = I_Realloc (s->calls, s->maxcalls * sizeof(*s->calls));
+    }
+
+    return &s->calls[s->numcalls++];
+}
+
+static void QueueColumn (void (*func) (void), int fuzzstart)
+{
+    drawcall_t*	call;
+    int		strip;
+
+    strip = dc_x * numdrawthreads / viewwidth;
+
+    if (strip < 0)
+	strip = 0;
+    else if (strip >= numdrawthreads)
+	strip = numdrawthreads - 1;
+
+    call = NewDrawCall (strip);
+    call->func = func;
+    call->span = false;
+    call->colormap = dc_colormap;
+    call->source = dc_source;
+    call->x = dc_x;
+    call->yl = dc_yl;
+    call->yh = dc_yh;
+    call->iscale = dc_iscale;
+    call->texturemid = dc_texturemid;
+    call->translation = dc_translation;
+    call->fuzzpos = fuzzstart;
+}
+
+static void R_QueueColumn (void)
+{
+    QueueColumn (drawcolumn, 0);
+}
+
+static void R_QueueTranslatedColumn (void)
+{
+    QueueColumn (drawtranscolumn, 0);
+}
+
+// The fuzz pattern carries on from one column to the next, so work out
+//  where this column starts in it, the same way the fuzz drawers do.
+static void R_QueueFuzzColumn (void)
+{
+    int		count;
+
+    if (!dc_yl)
+	dc_yl = 1;
+
+    if (dc_yh == viewheight-1)
+	dc_yh = viewheight - 2;
+
+    count = dc_yh - dc_yl;
+
+    if (count < 0)
+	return;
+
+    QueueColumn (drawfuzzcolumn, fuzzpos);
+
+    fuzzpos = (fuzzpos + count + 1) % FUZZTABLE;
+}
+
+// Spans are split where they cross from one strip into the next. Each
+//  piece starts from where the packed position would have got to, so it
+//  draws the same pixels the whole span would have.
+static void R_QueueSpan (void)
+{
+    drawcall_t*		call;
+    unsigned int	position, step, start;
+    int			strip, x1, x2;
+
+    position = ((ds_xfrac << 10) & 0xffff0000)
+             | ((ds_yfrac >> 6)  & 0x0000ffff);
+    step = ((ds_xstep << 10) & 0xffff0000)
+         | ((ds_ystep >> 6)  & 0x0000ffff);
+
+    for (x1 = ds_x1; x1 <= ds_x2; x1 = x2 + 1)
+    {
+	strip = x1 * numdrawthreads / viewwidth;
+
+	if (strip < numdrawthreads - 1)
+	{
+	    x2 = StripStart (strip + 1) - 1;
+
+	    if (x2 > ds_x2)
+		x2 = ds_x2;
+	}
+	else
+	{
+	    strip = numdrawthreads - 1;
+	    x2 = ds_x2;
+	}
+
+	start = position + (x1 - ds_x1) * step;
+
+	call = NewDrawCall (strip);
+	call->func = drawspan;
+	call->span = true;
+	call->colormap = ds_colormap;
+	call->source = ds_source;
+	call->y = ds_y;
+	call->x1 = x1;
+	call->x2 = x2;
+	call->xfrac = (start & 0xffff0000) >> 10;
+	call->yfrac = (start & 0x0000ffff) << 6;
+	call->xstep = ds_xstep;
+	call->ystep = ds_ystep;
+    }
+}
+
+// Sets the dc_* or ds_* variables from a draw call.
+static void SetDrawCall (drawcall_t* call)
+{
+    if (call->span)
+    {
+	ds_colormap = call->colormap;
+	ds_source = call->source;
+	ds_y = call->y;
+	ds_x1 = call->x1;
+	ds_x2 = call->x2;
+	ds_xfrac = call->xfrac;
+	ds_yfrac = call->yfrac;
+	ds_xstep = call->xstep;
+	ds_ystep = call->ystep;
+    }
+    else
+    {
+	dc_colormap = call->colormap;
+	dc_source = call->source;
+	dc_x = call->x;
+	dc_yl = call->yl;
+	dc_yh = call->yh;
+	dc_iscale = call->iscale;
+	dc_texturemid = call->texturemid;
+	dc_translation = call->translation;
+	fuzzpos = call->fuzzpos;
+    }
+}
+
+// The other way round, for both the dc_* and ds_* variables.
+static void GetDrawCalls (drawcall_t* column, drawcall_t* span)
+{
+    column->span = false;
+    column->colormap = dc_colormap;
+    column->source = dc_source;
+    column->x = dc_x;
+    column->yl = dc_yl;
+    column->yh = dc_yh;
+    column->iscale = dc_iscale;
+    column->texturemid = dc_texturemid;
+    column->translation = dc_translation;
+    column->fuzzpos = fuzzpos;
+
+    span->span = true;
+    span->colormap = ds_colormap;
+    span->source = ds_source;
+    span->y = ds_y;
+    span->x1 = ds_x1;
+    span->x2 = ds_x2;
+    span->xfrac = ds_xfrac;
+    span->yfrac = ds_yfrac;
+    span->xstep = ds_xstep;
+    span->ystep = ds_ystep;
+}
+
+static void DrawStrip (drawstrip_t* s)
+{
+    drawcall_t*	call;
+    int		i;
+
+    for (i = 0; i < s->numcalls; i++)
+    {
+	call = &s->calls[i];
+	SetDrawCall (call);
+	call->func ();
+    }
+
+    R_FlushColumns ();
+}
+
+static void* DrawThread (void* arg)
+{
+    drawstrip_t*	s;
+    unsigned int	generation;
+
+    s = arg;
+    generation = 0;
+
+    for (;;)
+    {
+	pthread_mutex_lock (&drawlock);
+
+	while (drawgeneration == generation)
+	    pthread_cond_wait (&drawstart, &drawlock);
+
+	generation = drawgeneration;
+	pthread_mutex_unlock (&drawlock);
+
+	DrawStrip (s);
+
+	pthread_mutex_lock (&drawlock);
+
+	if (--drawsleft == 0)
+	    pthread_cond_signal (&drawdone);
+
+	pthread_mutex_unlock (&drawlock);
+    }
+
+    return NULL;
+}
+
+
+static void FinishQueued (void)
+{
+    int		i;
+
+    if (!drawsinflight)
+	return;
+
+    pthread_mutex_lock (&drawlock);
+
+    while (drawsleft > 0)
+	pthread_cond_wait (&drawdone, &drawlock);
+
+    pthread_mutex_unlock (&drawlock);
+
+    for (i = 0; i < numdrawthreads; i++)
+	drawstrips[i].numcalls = 0;
+
+    drawsinflight = false;
+}
+
+
+//
+// R_StartQueued
+// Sets the threads drawing everything queued since the last call,
+//  without waiting for them. Nothing more can be queued until
+//  R_DrawQueued has waited for them to finish.
+//
+void R_StartQueued (void)
+{
+    if (!numdrawworkers || drawsinflight)
+	return;
+
+    pthread_mutex_lock (&drawlock);
+    drawgeneration++;
+    drawsleft = numdrawworkers;
+    pthread_cond_broadcast (&drawstart);
+    pthread_mutex_unlock (&drawlock);
+
+    drawsinflight = true;
+}
+
+
+//
+// R_DrawQueued
+// Draws everything queued since the last call, and waits for it and
+//  anything left drawing by R_StartQueued to be done.
+//
+void R_DrawQueued (void)
+{
+    drawcall_t	savedcolumn;
+    drawcall_t	savedspan;
+    int		queued;
+    int		i;
+
+    if (!numdrawworkers)
+	return;
+
+    FinishQueued ();
+
+    queued = 0;
+
+    for (i = 0; i < numdrawthreads; i++)
+	queued += drawstrips[i].numcalls;
+
+    if (!queued)
+	return;
+
+    R_StartQueued ();
+
+    // This thread takes the first strip if no other thread does. This
+    //  can be from a purge while the refresh is part way through setting
+    //  up a column or looping over dc_x, so everything DrawStrip sets
+    //  has to be put back, fuzzpos included.
+    if (numdrawworkers < numdrawthreads)
+    {
+	GetDrawCalls (&savedcolumn, &savedspan);
+	DrawStrip (&drawstrips[0]);
+	SetDrawCall (&savedcolumn);
+	SetDrawCall (&savedspan);
+    }
+
+    FinishQueued ();
+}
+
+
+// Draws everything queued or held back, before the graphics
+//  it uses can be purged.
+static void PurgeDraws (void)
+{
+    R_DrawQueued ();
+    R_FlushColumns ();
+}
+
+
+//
+// R_InitDrawThreads
+// Starts the threads for drawing the view in count strips. This thread
+//  draws the first strip itself, unless the drawing has to be able to
+//  carry on without it. With one strip drawn here, everything is drawn
+//  straight away as usual.
+//
+void R_InitDrawThreads (int count, boolean background)
+{
+    pthread_t	thread;
+    int		first;
+    int		i;
+
+    // Cached graphics can be purged to make room for new ones while
+    //  draws using them are still held back.
+    Z_SetPurgeCallback (PurgeDraws);
+
+    if (count < 1)
+	count = 1;
+
+    if (count == 1 && !background)
+	return;
+
+    numdrawthreads = count;
+    drawstrips = calloc (count, sizeof(*drawstrips));
+    first = background ? 0 : 1;
+
+    for (i = first; i < count; i++)
+    {
+	if (pthread_create (&thread, NULL, DrawThread, &drawstrips[i]))
+	    I_Error ("R_InitDrawThreads: failed to start thread %i", i);
+
+	pthread_detach (thread);
+    }
+
+    numdrawworkers = count - first;
+}
+
+
+//
+// R_QueueDrawFunctions
+// Swaps the drawing functions for ones that queue their draws up for
+//  the threads, if there are any.
+//
+void
+R_QueueDrawFunctions
+( void		(**colfunc) (void),
+  void		(**fuzzcolfunc) (void),
+  void		(**transcolfunc) (void),
+  void		(**spanfunc) (void) )
+{
+    if (!numdrawworkers)
+	return;
+
+    drawcolumn = *colfunc;
+    drawfuzzcolumn = *fuzzcolfunc;
+    drawtranscolumn = *transcolfunc;
+    drawspan = *spanfunc;
+
+    *colfunc = R_QueueColumn;
+    *fuzzcolfunc = R_QueueFuzzColumn;
+    *transcolfunc = R_QueueTranslatedColumn;
+    *spanfunc = R_QueueSpan;
+}
+
+
+//
+// R_InitBuffer 
+// Creats lookup tables that avoid
+//  multiplies and other hazzles
+//  for getting the framebuffer address
+//  of a pixel to draw.
+//
+void
+R_InitBuffer
+( int		width,
+  int		height ) 
+{ 
+    int		i; 
+
+    // Handle resize,
+    //  e.g. smaller view windows
+    //  with border and/or status bar.
+    viewwindowx = (SCREENWIDTH-width) >> 1; 
+
+    // Column offset. For windows.
+    for (i=0 ; i<width ; i++) 
+	columnofs[i] = viewwindowx + i;
+
+    // Samw with base row offset.
+    if (width == SCREENWIDTH) 
+	viewwindowy = 0; 
+    else 
+	viewwindowy = (SCREENHEIGHT-SBARHEIGHT-height) >> 1; 
+
+    // Preclaculate all row offsets.
+    for (i=0 ; i<height ; i++) 
+	ylookup[i] = I_VideoBuffer + (i+viewwindowy)*SCREENWIDTH; 
+
+    // Drawing transposed, the view's in a buffer of its own,
+    //  a column at a time.
+    if (viewtransposed)
+    {
+	for (i=0 ; i<width ; i++) 
+	    columnofs[i] = i*SCREENHEIGHT;
+
+	for (i=0 ; i<height ; i++) 
+	    ylookup[i] = transposedview + i; 
+    }
 } 
  
  
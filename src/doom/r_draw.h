@@ -23,15 +23,15 @@
 
 
 
-extern lighttable_t*	dc_colormap;
-extern int		dc_x;
-extern int		dc_yl;
-extern int		dc_yh;
-extern fixed_t		dc_iscale;
-extern fixed_t		dc_texturemid;
+extern THREADLOCAL lighttable_t*	dc_colormap;
+extern THREADLOCAL int		dc_x;
+extern THREADLOCAL int		dc_yl;
+extern THREADLOCAL int		dc_yh;
+extern THREADLOCAL fixed_t		dc_iscale;
+extern THREADLOCAL fixed_t		dc_texturemid;
 
 // first pixel in a column
-extern byte*		dc_source;		
+extern THREADLOCAL byte*		dc_source;		
 
 
 // The span blitting interface.
@@ -40,6 +40,10 @@ extern byte*		dc_source;
 void 	R_DrawColumn (void);
 void 	R_DrawColumnLow (void);
 
+// R_DrawColumn and R_DrawColumnLow hold columns back to draw
+//  four pixels wide at a time. Draws them now.
+void	R_FlushColumns (void);
+
 // The Spectre/Invisibility effect.
 void 	R_DrawFuzzColumn (void);
 void 	R_DrawFuzzColumnLow (void);
@@ -55,22 +59,22 @@ R_VideoErase
 ( unsigned	ofs,
   int		count );
 
-extern int		ds_y;
-extern int		ds_x1;
-extern int		ds_x2;
+extern THREADLOCAL int		ds_y;
+extern THREADLOCAL int		ds_x1;
+extern THREADLOCAL int		ds_x2;
 
-extern lighttable_t*	ds_colormap;
+extern THREADLOCAL lighttable_t*	ds_colormap;
 
-extern fixed_t		ds_xfrac;
-extern fixed_t		ds_yfrac;
-extern fixed_t		ds_xstep;
-extern fixed_t		ds_ystep;
+extern THREADLOCAL fixed_t		ds_xfrac;
+extern THREADLOCAL fixed_t		ds_yfrac;
+extern THREADLOCAL fixed_t		ds_xstep;
+extern THREADLOCAL fixed_t		ds_ystep;
 
 // start of a 64*64 tile image
-extern byte*		ds_source;		
+extern THREADLOCAL byte*		ds_source;		
 
 extern byte*		translationtables;
-extern byte*		dc_translation;
+extern THREADLOCAL byte*		dc_translation;
 
 
 // Span blitting for rows, floor/ceiling.
@@ -80,6 +84,14 @@ void 	R_DrawSpan (void);
 // Low resolution mode, 160x200?
 void 	R_DrawSpanLow (void);
 
+// The same span drawers using AVX2, for when the CPU has it.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_DRAWERS
+boolean	R_HaveAVX2 (void);
+void 	R_DrawSpanAVX2 (void);
+void 	R_DrawSpanLowAVX2 (void);
+#endif
+
 
 void
 R_InitBuffer
@@ -87,12 +99,41 @@ R_InitBuffer
   int		height );
 
 
+// Drawing the view column-major into a buffer of its own,
+//  and copying it onto the screen once it's done.
+void	R_SetTransposedView (boolean transposed);
+void	R_TransposeView (void);
+
+void	R_DrawColumnTransposed (void);
+void	R_DrawFuzzColumnTransposed (void);
+void	R_DrawTranslatedColumnTransposed (void);
+void	R_DrawSpanTransposed (void);
+
+
 // Initialize color translation tables,
 //  for player rendering etc.
 void	R_InitTranslationTables (void);
 
 
 
+// Drawing the view on several threads.
+// Columns and spans are queued up while the view is worked out,
+//  then drawn by R_DrawQueued, or left drawing by R_StartQueued.
+extern int		numdrawthreads;
+
+void	R_InitDrawThreads (int count, boolean background);
+
+void
+R_QueueDrawFunctions
+( void		(**colfunc) (void),
+  void		(**fuzzcolfunc) (void),
+  void		(**transcolfunc) (void),
+  void		(**spanfunc) (void) );
+
+void	R_StartQueued (void);
+void	R_DrawQueued (void);
+
+
 // Rendering function.
 void R_FillBackScreen (void);
 
@@ -28,6 +28,7 @@
 
 #include "doomdef.h"
 #include "d_loop.h"
+#include "m_argv.h"
 
 #include "m_bbox.h"
 #include "m_menu.h"
@@ -49,6 +50,12 @@ int			viewangleoffset;
 // increment every time a check is made
 int			validcount = 1;		
 
+// true if the view is drawn while the next frame's tics run
+boolean			pipelineview;
+
+// true if the view is drawn column-major, then transposed
+static boolean		transposeview;
+
 
 lighttable_t*		fixedcolormap;
 extern lighttable_t**	walllights;
@@ -673,6 +680,9 @@ void R_ExecuteSetViewSize (void)
     int		level;
     int		startmap; 	
 
+    // The view being drawn uses the sizes about to change.
+    R_DrawQueued ();
+
     setsizeneeded = false;
 
     if (setblocks == 11)
@@ -701,6 +711,17 @@ void R_ExecuteSetViewSize (void)
 	fuzzcolfunc = R_DrawFuzzColumn;
 	transcolfunc = R_DrawTranslatedColumn;
 	spanfunc = R_DrawSpan;
+#ifdef HAVE_AVX2_DRAWERS
+	if (R_HaveAVX2 ())
+	    spanfunc = R_DrawSpanAVX2;
+#endif
+	if (transposeview)
+	{
+	    colfunc = basecolfunc = R_DrawColumnTransposed;
+	    fuzzcolfunc = R_DrawFuzzColumnTransposed;
+	    transcolfunc = R_DrawTranslatedColumnTransposed;
+	    spanfunc = R_DrawSpanTransposed;
+	}
     }
     else
     {
@@ -708,8 +729,16 @@ void R_ExecuteSetViewSize (void)
 	fuzzcolfunc = R_DrawFuzzColumnLow;
 	transcolfunc = R_DrawTranslatedColumnLow;
 	spanfunc = R_DrawSpanLow;
+#ifdef HAVE_AVX2_DRAWERS
+	if (R_HaveAVX2 ())
+	    spanfunc = R_DrawSpanLowAVX2;
+#endif
     }
 
+    R_QueueDrawFunctions (&basecolfunc, &fuzzcolfunc, &transcolfunc, &spanfunc);
+    colfunc = basecolfunc;
+
+    R_SetTransposedView (transposeview && !detailshift);
     R_InitBuffer (scaledviewwidth, viewheight);
 	
     R_InitTextureMapping ();
@@ -766,6 +795,40 @@ void R_ExecuteSetViewSize (void)
 
 void R_Init (void)
 {
+    int p;
+    int threads;
+
+    //!
+    // @arg <n>
+    // @category video
+    //
+    // Draw the view on n threads, each drawing a strip of it.
+    //
+
+    p = M_CheckParmWithArgs ("-renderthreads", 1);
+    threads = p > 0 ? atoi (myargv[p+1]) : 1;
+
+    //!
+    // @category video
+    //
+    // Draw the view on other threads while the game runs the next
+    // frame's tics. The view on screen is a frame behind the status
+    // bar and messages.
+    //
+
+    pipelineview = M_CheckParm ("-pipelineview") > 0;
+
+    R_InitDrawThreads (threads, pipelineview);
+
+    //!
+    // @category video
+    //
+    // Draw the view column by column into a buffer of its own, then
+    // copy it onto the screen. Only affects high detail.
+    //
+
+    transposeview = M_CheckParm ("-transposeview") > 0;
+
     R_InitData ();
     printf (".");
     R_InitPointToAngle ();
@@ -860,7 +923,7 @@ void R_SetupFrame (player_t* player)
 //
 // R_RenderView
 //
-void R_RenderPlayerView (player_t* player)
+static void R_QueuePlayerView (player_t* player)
 {	
     R_SetupFrame (player);
 
@@ -886,6 +949,45 @@ void R_RenderPlayerView (player_t* player)
     
     R_DrawMasked ();
 
+    // The last few columns, if they were drawn here.
+    R_FlushColumns ();
+}
+
+void R_RenderPlayerView (player_t* player)
+{
+    R_QueuePlayerView (player);
+
+    // Draw the queued columns and spans, if drawing on threads,
+    //  and copy the view to the screen, if drawing it transposed.
+    R_FinishPlayerView ();
+
+    // Check for new console commands.
+    NetUpdate ();				
+}
+
+
+//
+// R_StartPlayerView
+// Like R_RenderPlayerView, but leaves the view drawing on the draw
+//  threads and returns. R_DrawQueued waits for it to be finished.
+//
+void R_StartPlayerView (player_t* player)
+{
+    R_QueuePlayerView (player);
+    R_StartQueued ();
+
     // Check for new console commands.
     NetUpdate ();				
 }
+
+
+//
+// R_FinishPlayerView
+// Waits for the view to be drawn and puts it on the screen,
+//  if it was drawn transposed.
+//
+void R_FinishPlayerView (void)
+{
+    R_DrawQueued ();
+    R_TransposeView ();
+}
@@ -46,6 +46,8 @@ extern fixed_t		projection;
 
 extern int		validcount;
 
+extern boolean		pipelineview;
+
 extern int		linecount;
 extern int		loopcount;
 
@@ -150,6 +152,8 @@ R_AddPointToBox
 
 // Called by G_Drawer.
 void R_RenderPlayerView (player_t *player);
+void R_StartPlayerView (player_t *player);
+void R_FinishPlayerView (void);
 
 // Called by startup code.
 void R_Init (void);
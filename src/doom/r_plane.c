@@ -23,6 +23,7 @@
 #include <stdlib.h>
 
 #include "i_system.h"
+#include "m_argv.h"
 #include "z_zone.h"
 #include "w_wad.h"
 
@@ -42,12 +43,25 @@ planefunction_t		ceilingfunc;
 //
 
 // Here comes the obnoxious "visplane".
+// Vanilla has room for MAXVISPLANES of them. We make more as needed,
+//  unless told to stop there like vanilla does.
 #define MAXVISPLANES	128
-visplane_t		visplanes[MAXVISPLANES];
-visplane_t*		lastvisplane;
+visplane_t**		visplanes;
+int			numvisplanes;
+static int		maxvisplanes;
+static boolean		visplanelimit;
 visplane_t*		floorplane;
 visplane_t*		ceilingplane;
 
+// Visplanes are looked up by hashing height, picnum and lightlevel.
+// Each chain is in the order the planes were made, so the first match
+//  is the one a search through all of them would find.
+#define VISPLANEHASHSIZE	256
+#define VISPLANEHASH(height, picnum, lightlevel) \
+    ((((unsigned) (height) >> FRACBITS) * 7 + (picnum) * 3 + (lightlevel)) \
+     & (VISPLANEHASHSIZE - 1))
+static visplane_t*	visplanehash[VISPLANEHASHSIZE];
+
 // ?
 #define MAXOPENINGS	SCREENWIDTH*64
 short			openings[MAXOPENINGS];
@@ -93,7 +107,14 @@ fixed_t			cachedystep[SCREENHEIGHT];
 //
 void R_InitPlanes (void)
 {
-  // Doh!
+    //!
+    // @category compat
+    //
+    // Exit with an error when there are more visplanes in view than
+    // Vanilla Doom has room for, as Vanilla does.
+    //
+
+    visplanelimit = M_CheckParm ("-visplanelimit") > 0;
 }
 
 
@@ -187,7 +208,8 @@ void R_ClearPlanes (void)
 	ceilingclip[i] = -1;
     }
 
-    lastvisplane = visplanes;
+    numvisplanes = 0;
+    memset (visplanehash, 0, sizeof(visplanehash));
     lastopening = openings;
     
     // texture calculation
@@ -204,6 +226,47 @@ void R_ClearPlanes (void)
 
 
 
+//
+// R_NewPlane
+// Takes the next free visplane, making more room if needed, and adds
+//  it to the end of its hash chain.
+//
+static visplane_t*
+R_NewPlane
+( fixed_t	height,
+  int		picnum,
+  int		lightlevel )
+{
+    visplane_t*		pl;
+    visplane_t**	link;
+    int			i;
+
+    if (numvisplanes == maxvisplanes)
+    {
+	maxvisplanes = maxvisplanes ? maxvisplanes * 2 : MAXVISPLANES;
+	visplanes = I_Realloc (visplanes, maxvisplanes * sizeof(*visplanes));
+
+	for (i = numvisplanes ; i < maxvisplanes ; i++)
+	    visplanes[i] = Z_Malloc (sizeof(visplane_t), PU_STATIC, NULL);
+    }
+
+    pl = visplanes[numvisplanes++];
+    pl->height = height;
+    pl->picnum = picnum;
+    pl->lightlevel = lightlevel;
+    pl->next = NULL;
+
+    link = &visplanehash[VISPLANEHASH(height, picnum, lightlevel)];
+
+    while (*link)
+	link = &(*link)->next;
+
+    *link = pl;
+
+    return pl;
+}
+
+
 //
 // R_FindPlane
 //
@@ -221,28 +284,22 @@ R_FindPlane
 	lightlevel = 0;
     }
 	
-    for (check=visplanes; check<lastvisplane; check++)
+    for (check = visplanehash[VISPLANEHASH(height, picnum, lightlevel)];
+	 check != NULL;
+	 check = check->next)
     {
 	if (height == check->height
 	    && picnum == check->picnum
 	    && lightlevel == check->lightlevel)
 	{
-	    break;
+	    return check;
 	}
     }
-    
-			
-    if (check < lastvisplane)
-	return check;
 		
-    if (lastvisplane - visplanes == MAXVISPLANES)
+    if (visplanelimit && numvisplanes == MAXVISPLANES)
 	I_Error ("R_FindPlane: no more visplanes");
 		
-    lastvisplane++;
-
-    check->height = height;
-    check->picnum = picnum;
-    check->lightlevel = lightlevel;
+    check = R_NewPlane (height, picnum, lightlevel);
     check->minx = SCREENWIDTH;
     check->maxx = -1;
     
@@ -303,14 +360,10 @@ R_CheckPlane
     }
 	
     // make a new visplane
-    lastvisplane->height = pl->height;
-    lastvisplane->picnum = pl->picnum;
-    lastvisplane->lightlevel = pl->lightlevel;
-    
-    if (lastvisplane - visplanes == MAXVISPLANES)
+    if (visplanelimit && numvisplanes == MAXVISPLANES)
 	I_Error ("R_CheckPlane: no more visplanes");
 
-    pl = lastvisplane++;
+    pl = R_NewPlane (pl->height, pl->picnum, pl->lightlevel);
     pl->minx = start;
     pl->maxx = stop;
 
@@ -363,6 +416,7 @@ R_MakeSpans
 void R_DrawPlanes (void)
 {
     visplane_t*		pl;
+    int			i;
     int			light;
     int			x;
     int			stop;
@@ -374,17 +428,15 @@ void R_DrawPlanes (void)
 	I_Error ("R_DrawPlanes: drawsegs overflow (%" PRIiPTR ")",
 		 ds_p - drawsegs);
     
-    if (lastvisplane - visplanes > MAXVISPLANES)
-	I_Error ("R_DrawPlanes: visplane overflow (%" PRIiPTR ")",
-		 lastvisplane - visplanes);
-    
     if (lastopening - openings > MAXOPENINGS)
 	I_Error ("R_DrawPlanes: opening overflow (%" PRIiPTR ")",
 		 lastopening - openings);
 #endif
 
-    for (pl = visplanes ; pl < lastvisplane ; pl++)
+    for (i = 0 ; i < numvisplanes ; i++)
     {
+	pl = visplanes[i];
+
 	if (pl->minx > pl->maxx)
 	    continue;
 
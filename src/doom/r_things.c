@@ -28,6 +28,7 @@
 
 #include "i_swap.h"
 #include "i_system.h"
+#include "m_argv.h"
 #include "z_zone.h"
 #include "w_wad.h"
 
@@ -278,9 +279,14 @@ void R_InitSpriteDefs(const char **namelist)
 //
 // GAME FUNCTIONS
 //
-vissprite_t	vissprites[MAXVISSPRITES];
+// Vanilla has room for MAXVISSPRITES, and leaves out any more sprites
+//  in view than that. We make more room as needed, unless told not to.
+//
+vissprite_t*	vissprites;
 vissprite_t*	vissprite_p;
 int		newvissprite;
+static int	maxvissprites;
+static boolean	visspritelimit;
 
 
 
@@ -296,6 +302,19 @@ void R_InitSprites(const char **namelist)
     {
 	negonearray[i] = -1;
     }
+
+    //!
+    // @category compat
+    //
+    // Leave out sprites past the number that Vanilla Doom has room
+    // for, as Vanilla does.
+    //
+
+    visspritelimit = M_CheckParm ("-visspritelimit") > 0;
+
+    maxvissprites = MAXVISSPRITES;
+    vissprites = I_Realloc (NULL, maxvissprites * sizeof(*vissprites));
+    vissprite_p = vissprites;
 	
     R_InitSpriteDefs (namelist);
 }
@@ -319,8 +338,18 @@ vissprite_t	overflowsprite;
 
 vissprite_t* R_NewVisSprite (void)
 {
-    if (vissprite_p == &vissprites[MAXVISSPRITES])
-	return &overflowsprite;
+    int		count;
+
+    if (vissprite_p == &vissprites[maxvissprites])
+    {
+	if (visspritelimit)
+	    return &overflowsprite;
+
+	count = vissprite_p - vissprites;
+	maxvissprites *= 2;
+	vissprites = I_Realloc (vissprites, maxvissprites * sizeof(*vissprites));
+	vissprite_p = vissprites + count;
+    }
     
     vissprite_p++;
     return vissprite_p-1;
@@ -772,59 +801,84 @@ void R_DrawPlayerSprites (void)
 
 //
 // R_SortVisSprites
+// Vanilla pulled the vissprites out by scale one at a time, taking the
+//  first of the smallest each time. That's the same order as a stable
+//  sort by scale, which a merge sort gets without the quadratic time.
 //
 vissprite_t	vsprsortedhead;
 
 
+// Merges two NULL terminated lists sorted by scale. Sprites of the same
+//  scale are taken from the first list first.
+static vissprite_t* R_MergeVisSprites (vissprite_t* a, vissprite_t* b)
+{
+    vissprite_t		merged;
+    vissprite_t*	tail;
+
+    tail = &merged;
+
+    while (a && b)
+    {
+	if (b->scale < a->scale)
+	{
+	    tail->next = b;
+	    b = b->next;
+	}
+	else
+	{
+	    tail->next = a;
+	    a = a->next;
+	}
+	tail = tail->next;
+    }
+
+    tail->next = a ? a : b;
+
+    return merged.next;
+}
+
+// Sorts count vissprites from first into a NULL terminated list.
+static vissprite_t* R_MergeSortVisSprites (vissprite_t* first, int count)
+{
+    int		half;
+
+    if (count == 1)
+    {
+	first->next = NULL;
+	return first;
+    }
+
+    half = count / 2;
+
+    return R_MergeVisSprites (R_MergeSortVisSprites (first, half),
+			      R_MergeSortVisSprites (first + half, count - half));
+}
+
 void R_SortVisSprites (void)
 {
-    int			i;
     int			count;
     vissprite_t*	ds;
-    vissprite_t*	best;
-    vissprite_t		unsorted;
-    fixed_t		bestscale;
+    vissprite_t*	prev;
 
     count = vissprite_p - vissprites;
-	
-    unsorted.next = unsorted.prev = &unsorted;
+
+    vsprsortedhead.next = vsprsortedhead.prev = &vsprsortedhead;
 
     if (!count)
 	return;
-		
-    for (ds=vissprites ; ds<vissprite_p ; ds++)
-    {
-	ds->next = ds+1;
-	ds->prev = ds-1;
-    }
-    
-    vissprites[0].prev = &unsorted;
-    unsorted.next = &vissprites[0];
-    (vissprite_p-1)->next = &unsorted;
-    unsorted.prev = vissprite_p-1;
-    
-    // pull the vissprites out by scale
 
-    vsprsortedhead.next = vsprsortedhead.prev = &vsprsortedhead;
-    for (i=0 ; i<count ; i++)
+    // link the sorted list back up both ways around vsprsortedhead
+    prev = &vsprsortedhead;
+    prev->next = R_MergeSortVisSprites (vissprites, count);
+
+    for (ds = prev->next ; ds ; ds = ds->next)
     {
-	bestscale = INT_MAX;
-        best = unsorted.next;
-	for (ds=unsorted.next ; ds!= &unsorted ; ds=ds->next)
-	{
-	    if (ds->scale < bestscale)
-	    {
-		bestscale = ds->scale;
-		best = ds;
-	    }
-	}
-	best->next->prev = best->prev;
-	best->prev->next = best->next;
-	best->next = &vsprsortedhead;
-	best->prev = vsprsortedhead.prev;
-	vsprsortedhead.prev->next = best;
-	vsprsortedhead.prev = best;
+	ds->prev = prev;
+	prev = ds;
     }
+
+    prev->next = &vsprsortedhead;
+    vsprsortedhead.prev = prev;
 }
 
 
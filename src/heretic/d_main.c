@@ -257,7 +257,10 @@ void D_DoomLoop(void)
 
         // Move positional sounds
         S_UpdateSounds(players[consoleplayer].mo);
-        D_Display();
+
+        // Update display, next frame, with current state.
+        if (screenvisible)
+            D_Display();
     }
 }
 
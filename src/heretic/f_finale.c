@@ -275,6 +275,11 @@ void F_DemonScroll(void)
     }
     if (yval < 64000)
     {
+        // The first picture moves down a row each time
+        if (yval > 0)
+        {
+            I_MoveRect(0, 0, SCREENWIDTH, SCREENHEIGHT, 0, 1);
+        }
         memcpy(I_VideoBuffer, p2 + SCREENHEIGHT * SCREENWIDTH - yval, yval);
         memcpy(I_VideoBuffer + yval, p1, SCREENHEIGHT * SCREENWIDTH - yval);
         yval += SCREENWIDTH;
@@ -838,7 +838,9 @@ void H2_GameLoop(void)
         // Move positional sounds
         S_UpdateSounds(players[displayplayer].mo);
 
-        DrawAndBlit();
+        // Update display, next frame, with current state.
+        if (screenvisible)
+            DrawAndBlit();
     }
 }
 
@@ -67,6 +67,7 @@ static music_module_t *active_music_module;
 // Sound modules
 
 extern void I_InitTimidityConfig(void);
+extern sound_module_t sound_vnc_module;
 extern sound_module_t sound_sdl_module;
 extern sound_module_t sound_pcsound_module;
 extern music_module_t music_sdl_module;
@@ -96,6 +97,7 @@ static int snd_mport = 0;
 
 static sound_module_t *sound_modules[] = 
 {
+    &sound_vnc_module,
     &sound_sdl_module,
     &sound_pcsound_module,
     NULL,
@@ -265,15 +267,45 @@ void I_InitSound(boolean use_sfx_prefix)
 
 void I_ShutdownSound(void)
 {
+    if (sound_module != NULL)
+    {
+        sound_module->Shutdown();
+    }
+
+    if (music_packs_active)
+    {
+        music_pack_module.Shutdown();
+    }
+
+    if (music_module != NULL)
+    {
+        music_module->Shutdown();
+    }
 }
 
 int I_GetSfxLumpNum(sfxinfo_t *sfxinfo)
 {
-    return 0;
+    if (sound_module != NULL)
+    {
+        return sound_module->GetSfxLumpNum(sfxinfo);
+    }
+    else
+    {
+        return 0;
+    }
 }
 
 void I_UpdateSound(void)
 {
+    if (sound_module != NULL)
+    {
+        sound_module->Update();
+    }
+
+    if (active_music_module != NULL && active_music_module->Poll != NULL)
+    {
+        active_music_module->Poll();
+    }
 }
 
 static void CheckVolumeSeparation(int *vol, int *sep)
@@ -299,24 +331,52 @@ static void CheckVolumeSeparation(int *vol, int *sep)
 
 void I_UpdateSoundParams(int channel, int vol, int sep)
 {
+    if (sound_module != NULL)
+    {
+        CheckVolumeSeparation(&vol, &sep);
+        sound_module->UpdateSoundParams(channel, vol, sep);
+    }
 }
 
 int I_StartSound(sfxinfo_t *sfxinfo, int channel, int vol, int sep, int pitch)
 {
-    return 0;
+    if (sound_module != NULL)
+    {
+        CheckVolumeSeparation(&vol, &sep);
+        return sound_module->StartSound(sfxinfo, channel, vol, sep, pitch);
+    }
+    else
+    {
+        return 0;
+    }
 }
 
 void I_StopSound(int channel)
 {
+    if (sound_module != NULL)
+    {
+        sound_module->StopSound(channel);
+    }
 }
 
 boolean I_SoundIsPlaying(int channel)
 {
-    return false;
+    if (sound_module != NULL)
+    {
+        return sound_module->SoundIsPlaying(channel);
+    }
+    else
+    {
+        return false;
+    }
 }
 
 void I_PrecacheSounds(sfxinfo_t *sounds, int num_sounds)
 {
+    if (sound_module != NULL && sound_module->CacheSounds != NULL)
+    {
+        sound_module->CacheSounds(sounds, num_sounds);
+    }
 }
 
 void I_InitMusic(void)
@@ -330,36 +390,94 @@ void I_ShutdownMusic(void)
 
 void I_SetMusicVolume(int volume)
 {
+    if (active_music_module != NULL)
+    {
+        active_music_module->SetMusicVolume(volume);
+    }
 }
 
 void I_PauseSong(void)
 {
+    if (active_music_module != NULL)
+    {
+        active_music_module->PauseMusic();
+    }
 }
 
 void I_ResumeSong(void)
 {
+    if (active_music_module != NULL)
+    {
+        active_music_module->ResumeMusic();
+    }
 }
 
 void *I_RegisterSong(void *data, int len)
 {
-    return NULL;
+    // If the music pack module is active, check to see if there is a
+    // valid substitution for this track. If there is, we set the
+    // active_music_module pointer to the music pack module for the
+    // duration of this particular track.
+
+    if (music_packs_active)
+    {
+        void *handle;
+
+        handle = music_pack_module.RegisterSong(data, len);
+        if (handle != NULL)
+        {
+            active_music_module = &music_pack_module;
+            return handle;
+        }
+    }
+
+    // No substitution for this track, so use the main module.
+
+    active_music_module = music_module;
+    if (active_music_module != NULL)
+    {
+        return active_music_module->RegisterSong(data, len);
+    }
+    else
+    {
+        return NULL;
+    }
 }
 
 void I_UnRegisterSong(void *handle)
 {
+    if (active_music_module != NULL)
+    {
+        active_music_module->UnRegisterSong(handle);
+    }
 }
 
 void I_PlaySong(void *handle, boolean looping)
 {
+    if (active_music_module != NULL)
+    {
+        active_music_module->PlaySong(handle, looping);
+    }
 }
 
 void I_StopSong(void)
 {
+    if (active_music_module != NULL)
+    {
+        active_music_module->StopSong();
+    }
 }
 
 boolean I_MusicIsPlaying(void)
 {
-    return false;
+    if (active_music_module != NULL)
+    {
+        return active_music_module->MusicIsPlaying();
+    }
+    else
+    {
+        return false;
+    }
 }
 
 void I_BindSoundVariables(void)
@@ -77,6 +77,12 @@ char *video_driver = "";
 
 char *window_position = "center";
 
+// Address and port to accept VNC clients on. An empty address means
+// every interface.
+
+char *vnc_address = "";
+int vnc_port = 5902;
+
 // SDL display number on which to run.
 
 int video_display = 0;
@@ -150,6 +156,20 @@ static boolean display_fps_dots;
 
 static boolean noblit;
 
+// If this is true, frames are only drawn when a VNC client is waiting
+// for one.
+
+static boolean render_on_demand;
+
+// If this is true, there's no VNC server and frames go nowhere, so that
+// the game can run as fast as it's able to without anybody watching.
+
+static boolean null_video;
+
+// If this is true, the screen isn't rendered at all.
+
+static boolean norender;
+
 // Callback function to invoke to determine whether to grab the 
 // mouse pointer.
 
@@ -237,7 +257,10 @@ void I_ShutdownGraphics(void)
     {
         SetShowCursor(true);
         free(I_VideoBuffer);
-        VNC_Exit(&vnc_server);
+        if (!null_video)
+        {
+            VNC_Exit(&vnc_server);
+        }
         initialized = false;
     }
 }
@@ -263,7 +286,10 @@ static void I_ToggleFullScreen(void)
 
 void I_GetEvent(void)
 {
-    VNC_PumpMessages(&vnc_server);
+    if (!null_video)
+    {
+        VNC_PumpMessages(&vnc_server);
+    }
 }
 
 //
@@ -277,6 +303,38 @@ void I_StartTic (void)
     }
 
     I_GetEvent();
+
+    // Nobody will see a frame until a client asks for one, so there's no
+    // point in drawing it. The game keeps running in the meantime.
+
+    if (norender)
+    {
+        screenvisible = false;
+    }
+    else if (render_on_demand && !null_video)
+    {
+        screenvisible = VNC_FrameWanted(&vnc_server);
+    }
+}
+
+
+//
+// I_TicBuilt, I_TicRun
+//
+void I_TicBuilt (int tic)
+{
+    if (!null_video)
+    {
+        VNC_TicBuilt(&vnc_server, tic);
+    }
+}
+
+void I_TicRun (int tic)
+{
+    if (!null_video)
+    {
+        VNC_TicRun(&vnc_server, tic);
+    }
 }
 
 
@@ -309,7 +367,7 @@ void I_FinishUpdate (void)
     int tics;
     int i;
 
-    if (!initialized)
+    if (!initialized || null_video)
         return;
 
     // draws little dots on the bottom of the screen
@@ -346,6 +404,20 @@ void I_ReadScreen (pixel_t* scr)
 }
 
 
+//
+// I_MoveRect
+//
+void I_MoveRect(int x, int y, int width, int height, int dx, int dy)
+{
+    if (null_video)
+    {
+        return;
+    }
+
+    VNC_MoveRect(&vnc_server, x, y, width, height, dx, dy);
+}
+
+
 //
 // I_SetPalette
 //
@@ -358,7 +430,10 @@ void I_SetPalette (byte *doompalette)
         palette[i].b = gammatable[usegamma][*(doompalette++)] & ~3;
     }
 
-    VNC_PreparePalette(&vnc_server, palette);
+    if (!null_video)
+    {
+        VNC_PreparePalette(&vnc_server, palette);
+    }
 }
 
 // Given an RGB value, find the closest matching palette index.
@@ -451,13 +526,116 @@ static void SetVideoMode(void)
 
 void I_InitGraphics(void)
 {
+    int i;
+
     I_VideoBuffer = malloc(SCREENWIDTH * SCREENHEIGHT * sizeof(pixel_t));
-    VNC_Init(&vnc_server, SCREENWIDTH, SCREENHEIGHT);
+
+    //!
+    // @category video
+    //
+    // Don't start a VNC server, and throw every frame away once it's been
+    // drawn. For running demos and benchmarks as fast as possible on
+    // machines where nobody is watching.
+    //
+
+    null_video = M_ParmExists("-nullvideo");
+
+    //!
+    // @category video
+    //
+    // Don't render the screen at all, so that only the game itself is
+    // run. Most useful with -nullvideo.
+    //
+
+    norender = M_ParmExists("-norender");
+
+    //!
+    // @category video
+    //
+    // Periodically print statistics about each VNC client's connection
+    // and the encodings picked for it, and how long the player's input
+    // takes to show up on their screen.
+    //
+
+    vnc_server.show_stats = M_ParmExists("-vncstats");
+
+    //!
+    // @category video
+    //
+    // Send large VNC updates without copying them into the kernel, on
+    // systems that support it.
+    //
+
+    vnc_server.zerocopy = M_ParmExists("-vnczerocopy");
+
+    //!
+    // @category video
+    //
+    // Only draw frames when a VNC client is waiting for one, rather than
+    // every frame. Saves the time spent drawing frames that nobody would
+    // see, such as while every client is busy or none are connected.
+    //
+
+    render_on_demand = M_ParmExists("-vncondemand");
+
+    //!
+    // @category video
+    // @arg <file>
+    //
+    // Record every frame and palette sent to VNC clients, along with the
+    // player's input, to the given file. The vncbench tool plays it back
+    // through each of the encoders.
+    //
+
+    i = M_CheckParmWithArgs("-vncrecord", 1);
+
+    if (i > 0)
+    {
+        vnc_server.record_path = myargv[i + 1];
+    }
+
+    //!
+    // @category video
+    // @arg <port>
+    //
+    // Accept VNC clients on the given port.
+    //
+
+    i = M_CheckParmWithArgs("-vncport", 1);
+
+    if (i > 0)
+    {
+        vnc_port = atoi(myargv[i + 1]);
+    }
+
+    //!
+    // @category video
+    // @arg <address>
+    //
+    // Only accept VNC clients on the network interface with the given
+    // IPv4 address.
+    //
+
+    i = M_CheckParmWithArgs("-vncaddr", 1);
+
+    if (i > 0)
+    {
+        vnc_address = myargv[i + 1];
+    }
+
+    if (!null_video)
+    {
+        VNC_Init(&vnc_server, SCREENWIDTH, SCREENHEIGHT, vnc_address, vnc_port);
+    }
 
     byte *doompal;
     doompal = W_CacheLumpName(DEH_String("PLAYPAL"), PU_CACHE);
     I_SetPalette(doompal);
-    VNC_PreparePalette(&vnc_server, doompal);
+
+    if (!null_video)
+    {
+        VNC_PreparePalette(&vnc_server, doompal);
+    }
 
     V_RestoreBuffer();
     // Clear the screen to black.
@@ -490,4 +668,6 @@ void I_BindVideoVariables(void)
     M_BindStringVariable("window_position",        &window_position);
     M_BindIntVariable("usegamma",                  &usegamma);
     M_BindIntVariable("png_screenshots",           &png_screenshots);
+    M_BindStringVariable("vnc_address",            &vnc_address);
+    M_BindIntVariable("vnc_port",                  &vnc_port);
 }
@@ -51,6 +51,10 @@ void I_FinishUpdate (void);
 
 void I_ReadScreen (pixel_t* scr);
 
+// Hint that the given area of the last frame shown has moved by (dx, dy)
+// in the next one, so that it can be copied rather than drawn again.
+void I_MoveRect(int x, int y, int width, int height, int dx, int dy);
+
 void I_BeginRead (void);
 
 void I_SetWindowTitle(const char *title);
@@ -74,6 +78,12 @@ void I_StartFrame (void);
 
 void I_StartTic (void);
 
+// Called once the commands for a tic have been built, and again once
+// they've been run.
+
+void I_TicBuilt (int tic);
+void I_TicRun (int tic);
+
 // Enable the loading disk image displayed when reading from disk.
 
 void I_EnableLoadingDisk(int xoffs, int yoffs);
@@ -95,6 +105,8 @@ extern int vga_porch_flash;
 extern int force_software_renderer;
 
 extern char *window_position;
+extern char *vnc_address;
+extern int vnc_port;
 void I_GetWindowPosition(int *x, int *y, int w, int h);
 
 // Joystic/gamepad hysteresis
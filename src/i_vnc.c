@@ -12,31 +12,131 @@
 // GNU General Public License for more details.
 //
 
+#include "deflate.h"
 #include "doomkeys.h"
 #include "d_event.h"
 #include "i_system.h"
 #include "i_vnc.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
-#include <sys/time.h>
+#include <time.h>
 #include <sys/socket.h>
-#include <sys/select.h>
+#include <sys/ioctl.h>
 #include <netinet/in.h>
 
+#ifdef __linux__
+#include <linux/sockios.h>
+#endif
+
+// Faster pixel kernels for x86 processors that have them, picked when the
+// server starts
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define VNC_HAVE_AVX2
+#endif
+
+// Zero-copy sends need MSG_ZEROCOPY, which only Linux has
+#if defined(__linux__) && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#include <linux/errqueue.h>
+#define VNC_HAVE_ZEROCOPY
+#define VNC_SEND_ZEROCOPY MSG_ZEROCOPY
+#else
+#define VNC_SEND_ZEROCOPY 0
+#endif
+
+// Where the kernel can tell us when data arrived on a socket, the latency
+// statistics include how long the player's input waited to be read
+#if defined(SO_TIMESTAMPNS) && defined(SCM_TIMESTAMPNS)
+#define VNC_HAVE_ARRIVAL_TIME
+#endif
+
+// Recordings start with the magic and the size of the screen, followed by one
+// record per palette, frame and input message the server was handed. Each
+// record is its type and the milliseconds since the recording started, and
+// then:
+//
+// - palettes: 256 RGB triplets
+// - frames: the number of moves and each move's x, y, w, h, src_x and src_y,
+//   followed by pairs of lengths counting pixels that are the same as the
+//   last frame recorded and pixels that are different, with the different
+//   pixels after each pair, until the screen is covered
+// - input: the client it came from, the length of the message and the
+//   message as the client sent it
+//
+// Numbers are little-endian, apart from the lengths of runs of pixels, which
+// take seven bits per byte with the top bit set on all but the last.
+#define VNC_RECORD_MAGIC "VNCREC1\n"
+#define VNC_RECORD_PALETTE 'P'
+#define VNC_RECORD_FRAME 'F'
+#define VNC_RECORD_INPUT 'I'
+
+// Shortest run of unchanged pixels a frame record skips over, since anything
+// shorter takes more to describe than to store
+#define VNC_RECORD_MIN_SKIP 8
+
 #define VNC_CLIENT_SETPIXELFORMAT 0
 #define VNC_CLIENT_SETENCODINGS 2
 #define VNC_CLIENT_FRAMEBUFFERUPDATEREQUEST 3
 #define VNC_CLIENT_KEYEVENT 4
 #define VNC_CLIENT_POINTEREVENT 5
 #define VNC_CLIENT_CLIENTCUTTEXT 6
+#define VNC_CLIENT_ENABLECONTINUOUSUPDATES 150
+#define VNC_CLIENT_FENCE 248
+#define VNC_CLIENT_QEMU 255
 
 #define VNC_SERVER_FRAMEBUFFERUPDATE 0
 #define VNC_SERVER_SETCOLORMAPENTRIES 1
+#define VNC_SERVER_ENDOFCONTINUOUSUPDATES 150
+#define VNC_SERVER_FENCE 248
+#define VNC_SERVER_QEMU 255
+
+// Pseudo-encodings that clients list in SetEncodings to tell us which
+// extensions they understand
+#define VNC_PSEUDO_FENCE -312
+#define VNC_PSEUDO_CONTINUOUSUPDATES -313
+#define VNC_PSEUDO_QEMUAUDIO -259
+
+// QEMU's messages all share one type, with a submessage type after it. Audio
+// has a U16 operation after that.
+#define VNC_QEMU_AUDIO 1
+#define VNC_QEMU_AUDIO_ENABLE 0
+#define VNC_QEMU_AUDIO_DISABLE 1
+#define VNC_QEMU_AUDIO_SETFORMAT 2
+#define VNC_QEMU_AUDIO_END 0
+#define VNC_QEMU_AUDIO_BEGIN 1
+#define VNC_QEMU_AUDIO_DATA 2
+
+// Sample formats a client can ask for, in the order QEMU numbers them. Each
+// pair is twice the size of the one before, unsigned and then signed.
+#define VNC_AUDIO_U8 0
+#define VNC_AUDIO_S8 1
+#define VNC_AUDIO_U16 2
+#define VNC_AUDIO_S16 3
+#define VNC_AUDIO_U32 4
+#define VNC_AUDIO_S32 5
+
+// Clients can ask for any rate in this range, and we convert ours to it
+#define VNC_AUDIO_MIN_FREQUENCY 1000
+#define VNC_AUDIO_MAX_FREQUENCY 192000
+
+#define VNC_FENCE_BLOCKBEFORE 0x1
+#define VNC_FENCE_BLOCKAFTER 0x2
+#define VNC_FENCE_SYNCNEXT 0x4
+#define VNC_FENCE_REQUEST 0x80000000u
+#define VNC_FENCE_MAX_PAYLOAD 64
+
+// Not every platform can turn off SIGPIPE per call; those that can't will
+// just have to not lose their clients
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
 
 static const char vnc_keysym_unshifted[] = {
     // Control characters, these have no meaningful casing
@@ -88,7 +188,7 @@ static int SendAll(int sock, byte* buffer, int size)
     int offset = 0;
     while (offset < size)
     {
-        int chunk = send(sock, buffer + offset, size - offset, 0);
+        int chunk = send(sock, buffer + offset, size - offset, MSG_NOSIGNAL);
         if (chunk <= 0)
         {
             // Client disconnected or something else unusual happened
@@ -101,45 +201,338 @@ static int SendAll(int sock, byte* buffer, int size)
     return 0;
 }
 
-static int RecvAll(int sock, byte* buffer, int size)
+// Lets the sender thread know that there may be something for it to do
+static void WakeSender(vnc_server_t *server)
 {
-    int offset = 0;
-    while (offset < size)
+    byte signal = 0;
+
+    // The pipe is non-blocking, and if it's full the sender has plenty of
+    // wakeups queued already
+    if (write(server->wake_pipe[1], &signal, 1) < 0 && errno != EAGAIN)
     {
-        int chunk = recv(sock, buffer + offset, size - offset, 0);
-        if (chunk <= 0)
+        printf("WakeSender: Could not signal sender (%s)\n", strerror(errno));
+    }
+}
+
+static int GetTimeMS(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static int64_t GetTimeUS(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Folds a new measurement into a running average
+static double Average(double average, double sample, int count)
+{
+    if (count == 0)
+    {
+        return sample;
+    }
+
+    return average + (sample - average) / 8;
+}
+
+// Queues a message to be written to an active client ahead of its next update.
+// A client that lets these pile up isn't reading what we send, so it's
+// dropped.
+static void QueueControl(vnc_server_t *server, vnc_client_t *client, byte *data, int size)
+{
+    pthread_mutex_lock(&server->lock);
+    if (client->control_size + size > VNC_CONTROL_SIZE)
+    {
+        printf("QueueControl: Dropped client %d (too many queued messages)\n", (int) (client - server->clients));
+        client->dead = true;
+    }
+    else
+    {
+        memcpy(client->control + client->control_size, data, size);
+        client->control_size += size;
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    WakeSender(server);
+}
+
+static void QueueFence(vnc_server_t *server, vnc_client_t *client, uint32_t flags, byte *payload, int length)
+{
+    byte message[9 + VNC_FENCE_MAX_PAYLOAD];
+    message[0] = VNC_SERVER_FENCE;
+    message[1] = 0; // Padding
+    message[2] = 0;
+    message[3] = 0;
+    message[4] = (flags >> 24) & 0xff;
+    message[5] = (flags >> 16) & 0xff;
+    message[6] = (flags >> 8) & 0xff;
+    message[7] = flags & 0xff;
+    message[8] = length;
+    memcpy(message + 9, payload, length);
+
+    QueueControl(server, client, message, 9 + length);
+}
+
+// Handles the client's answer to one of the fences we send after continuous
+// updates, which means everything up to that update has arrived. If the round
+// trip took much longer than usual, the updates are waiting in a queue
+// somewhere and we back off. Otherwise, if we were anywhere near the limit,
+// there's room to push a bit harder.
+static void AcknowledgeFence(vnc_server_t *server, vnc_client_t *client, byte *payload)
+{
+    uint32_t sent_time =
+        (payload[0] << 24) | (payload[1] << 16) | (payload[2] << 8) | payload[3];
+    uint32_t sent_bytes =
+        (payload[4] << 24) | (payload[5] << 16) | (payload[6] << 8) | payload[7];
+    int rtt = (uint32_t) GetTimeMS() - sent_time;
+    uint32_t in_flight;
+
+    pthread_mutex_lock(&server->lock);
+    // Answers to fences from before continuous updates were last turned on
+    // don't count
+    if ((int32_t) (sent_bytes - client->bytes_acked) <= 0)
+    {
+        pthread_mutex_unlock(&server->lock);
+        return;
+    }
+
+    in_flight = client->bytes_sent - client->bytes_acked;
+    client->bytes_acked = sent_bytes;
+    if (client->continuous && client->bytes_sent - client->bytes_acked < (uint32_t) client->window)
+    {
+        atomic_store(&server->frame_wanted, 1);
+    }
+
+    if (client->min_rtt == -1 || rtt < client->min_rtt)
+    {
+        client->min_rtt = rtt;
+    }
+
+    if (rtt > client->min_rtt + VNC_RTT_SLACK)
+    {
+        if ((int32_t) (sent_bytes - client->backoff_mark) > 0)
         {
-            // Client disconnected or something else unusual happened
-            return -1;
-        }
+            client->window /= 2;
+            if (client->window < VNC_WINDOW_MIN)
+            {
+                client->window = VNC_WINDOW_MIN;
+            }
 
-        offset += chunk;
+            client->backoff_mark = client->bytes_sent;
+        }
+    }
+    else if (in_flight >= client->window / 2)
+    {
+        client->window += client->window / 4;
+        if (client->window > VNC_WINDOW_MAX)
+        {
+            client->window = VNC_WINDOW_MAX;
+        }
     }
+    pthread_mutex_unlock(&server->lock);
 
-    return 0;
+    WakeSender(server);
 }
 
-static int FinalizeVNCMessages(vnc_server_t *server, int offset)
+static int FinalizeVNCMessages(vnc_client_t *client, int offset)
 {
-    byte* leftover_data = server->client_packet + offset;
-    int leftover_size = server->packet_cursor - offset;
+    byte* leftover_data = client->client_packet + offset;
+    int leftover_size = client->packet_cursor - offset;
 
     if (leftover_size > 0)
     {
         // *Hopefully* this is smart enough to figure out that it can safely copy
         // through the array backwards without having to use scratch space
-        memmove(server->client_packet, leftover_data, leftover_size);
+        memmove(client->client_packet, leftover_data, leftover_size);
+    }
+
+    client->packet_cursor = leftover_size;
+}
+
+// Takes a client out of the game. Clients that haven't finished the handshake
+// yet can be closed right away, but the sender may be in the middle of writing
+// to an active one, so those are left for it to close.
+static void DropClient(vnc_server_t *server, vnc_client_t *client)
+{
+    if (server->controller != -1 && &server->clients[server->controller] == client)
+    {
+        server->controller = -1;
+    }
+
+    pthread_mutex_lock(&server->lock);
+    if (client->state != VNC_CLIENT_ACTIVE)
+    {
+        close(client->peer);
+        client->state = VNC_CLIENT_FREE;
+    }
+    else
+    {
+        client->dead = true;
+        client->released = true;
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    WakeSender(server);
+}
+
+static void SetClientState(vnc_server_t *server, vnc_client_t *client, vnc_client_state_t state)
+{
+    pthread_mutex_lock(&server->lock);
+    client->state = state;
+    pthread_mutex_unlock(&server->lock);
+}
+
+static void RecordNumber(vnc_server_t *server, uint32_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        fputc((value >> (i * 8)) & 0xff, server->record);
+    }
+}
+
+static void RecordLength(vnc_server_t *server, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        fputc((value & 0x7f) | 0x80, server->record);
+        value >>= 7;
+    }
+
+    fputc(value, server->record);
+}
+
+static void RecordHeader(vnc_server_t *server, byte type)
+{
+    fputc(type, server->record);
+    RecordNumber(server, GetTimeMS() - server->record_start, 4);
+}
+
+static void StartRecording(vnc_server_t *server)
+{
+    server->record = fopen(server->record_path, "wb");
+    if (server->record == NULL)
+    {
+        I_Error("StartRecording: Could not open %s (%s)", server->record_path, strerror(errno));
+    }
+
+    server->record_frame = calloc(server->width * server->height, 1);
+    server->record_start = GetTimeMS();
+
+    fwrite(VNC_RECORD_MAGIC, 1, 8, server->record);
+    RecordNumber(server, server->width, 2);
+    RecordNumber(server, server->height, 2);
+    printf("StartRecording: Recording to %s\n", server->record_path);
+}
+
+static void RecordPalette(vnc_server_t *server)
+{
+    RecordHeader(server, VNC_RECORD_PALETTE);
+    fwrite(server->next_palette, 1, 256 * 3, server->record);
+}
+
+static void RecordFrame(vnc_server_t *server, vnc_frame_t *frame)
+{
+    byte* last = server->record_frame;
+    byte* pixels = frame->pixels;
+    int size = server->width * server->height;
+    int pos = 0;
+
+    RecordHeader(server, VNC_RECORD_FRAME);
+    RecordNumber(server, frame->move_count, 2);
+    for (int i = 0; i < frame->move_count; i++)
+    {
+        vnc_move_t* move = &frame->moves[i];
+        RecordNumber(server, move->x, 2);
+        RecordNumber(server, move->y, 2);
+        RecordNumber(server, move->w, 2);
+        RecordNumber(server, move->h, 2);
+        RecordNumber(server, move->src_x, 2);
+        RecordNumber(server, move->src_y, 2);
+    }
+
+    while (pos < size)
+    {
+        int start = pos;
+        int same;
+        int run = 0;
+
+        while (pos < size && pixels[pos] == last[pos])
+        {
+            pos++;
+        }
+
+        same = pos - start;
+
+        // The different pixels go on until the next run that's worth
+        // skipping over
+        start = pos;
+        while (pos < size && run < VNC_RECORD_MIN_SKIP)
+        {
+            run = pixels[pos] == last[pos] ? run + 1 : 0;
+            pos++;
+        }
+
+        if (run == VNC_RECORD_MIN_SKIP)
+        {
+            pos -= run;
+        }
+
+        RecordLength(server, same);
+        RecordLength(server, pos - start);
+        fwrite(pixels + start, 1, pos - start, server->record);
+    }
+
+    memcpy(last, pixels, size);
+}
+
+static void RecordInput(vnc_server_t *server, vnc_client_t *client, byte *message, int length)
+{
+    if (server->record == NULL)
+    {
+        return;
+    }
+
+    RecordHeader(server, VNC_RECORD_INPUT);
+    fputc(client - server->clients, server->record);
+    fputc(length, server->record);
+    fwrite(message, 1, length, server->record);
+}
+
+// Starts following the input that was just read from the client through to
+// the frame that shows it, unless we're already following some. Only done
+// when the statistics are on.
+static void FollowInput(vnc_server_t *server, vnc_client_t *client)
+{
+    if (!server->show_stats || server->probe.client != -1)
+    {
+        return;
     }
 
-    server->packet_cursor = leftover_size;
+    server->probe.client = client - server->clients;
+    server->probe.tic = -1;
+    server->probe.arrived = server->read_arrived;
+    server->probe.read = server->read_time;
+    server->probe.ran = -1;
+    server->probe.drawn = -1;
 }
 
-static int HandleVNCMessage(vnc_server_t *server, int message_scan_pos, int* cursor_x, int* cursor_y, int* mouse_buttons)
+// Handles the next message in the client's buffer, and returns the position
+// just after it. Returns -1 if the message isn't complete yet, -2 if we
+// couldn't make sense of it, or -3 if the client had to be dropped.
+static int HandleVNCMessage(vnc_server_t *server, vnc_client_t *client, int message_scan_pos, int* cursor_x, int* cursor_y, int* mouse_buttons)
 {
-    byte* packet_base = server->client_packet + message_scan_pos;
-    int data_left = server->packet_cursor - message_scan_pos;
+    byte* packet_base = client->client_packet + message_scan_pos;
+    int data_left = client->packet_cursor - message_scan_pos;
+    boolean in_control;
     if (data_left == 0) return -1;
 
+    // Spectators can look but not touch
+    in_control = server->controller != -1 && &server->clients[server->controller] == client;
+
     switch (packet_base[0])
     {
         case VNC_CLIENT_SETPIXELFORMAT:
@@ -149,21 +542,32 @@ static int HandleVNCMessage(vnc_server_t *server, int message_scan_pos, int* cur
 
                 if (data_left >= 20)
                 {
-                    if (!true_color)
+                    // We can do 32-bit true color, or 8-bit color map which is
+                    // what Doom draws in to begin with
+                    vnc_pixel_format_t pixel_format;
+                    if (true_color && px_size == 32)
+                    {
+                        pixel_format = VNC_TRUECOLOR;
+                    }
+                    else if (!true_color && px_size == 8)
                     {
-                      printf("HandleVNCMessage: Unsupported palette color mode\n");
-                      VNC_Exit(server);
-                      I_Quit();
-                      return -1;
+                        printf("HandleVNCMessage: Moving to color map mode at client request\n");
+                        pixel_format = VNC_COLORMAP;
+                    }
+                    else
+                    {
+                        printf("HandleVNCMessage: Unsupported pixel format: %d bpp, true color %d\n", px_size, true_color);
+                        DropClient(server, client);
+                        return -3;
                     }
 
-                    if (px_size != 32)
+                    pthread_mutex_lock(&server->lock);
+                    if (client->pixel_format != pixel_format)
                     {
-                        printf("HandleVNCMessage: Unsupported pixel size mode: %d\n", px_size);
-                        VNC_Exit(server);
-                        I_Quit();
-                        return -1;
+                        client->pixel_format = pixel_format;
+                        client->pixel_format_changed = true;
                     }
+                    pthread_mutex_unlock(&server->lock);
 
                     return message_scan_pos + 20;
                 }
@@ -171,40 +575,117 @@ static int HandleVNCMessage(vnc_server_t *server, int message_scan_pos, int* cur
             break;
 
         case VNC_CLIENT_SETENCODINGS:
-            if (server->packet_cursor - message_scan_pos >= 4)
+            if (client->packet_cursor - message_scan_pos >= 4)
             {
                 // We can figure out the true size by looking at the encoding count
                 int encoding_count = (packet_base[2] << 8) | packet_base[3];
                 int expect_length = 4 + encoding_count * 4;
 
-                boolean contains_tight = false;
-                int encoding_offset = 4;
-                for (int i = 0; i < encoding_count; i++)
+                if (data_left >= expect_length)
                 {
-                    int encoding =
-                        (packet_base[encoding_offset] << 24) |
-                        (packet_base[encoding_offset + 1] << 16) |
-                        (packet_base[encoding_offset + 2] << 8) |
-                        packet_base[encoding_offset + 3];
-
-                    encoding_offset += 4;
-                    if (encoding == VNC_TIGHT)
+                    boolean contains_tight = false;
+                    boolean contains_fence = false;
+                    boolean contains_continuous = false;
+                    boolean contains_audio = false;
+                    boolean contains_copyrect = false;
+                    int encoding_offset = 4;
+                    vnc_encoding_t picked = VNC_RAW;
+                    boolean announce_fence;
+                    boolean announce_continuous;
+                    boolean announce_audio;
+                    for (int i = 0; i < encoding_count; i++)
                     {
-                        contains_tight = true;
-                        break;
+                        int encoding =
+                            (packet_base[encoding_offset] << 24) |
+                            (packet_base[encoding_offset + 1] << 16) |
+                            (packet_base[encoding_offset + 2] << 8) |
+                            packet_base[encoding_offset + 3];
+
+                        encoding_offset += 4;
+                        switch (encoding)
+                        {
+                            case VNC_TIGHT:
+                                contains_tight = true;
+                                break;
+                            case VNC_COPYRECT:
+                                contains_copyrect = true;
+                                break;
+                            case VNC_PSEUDO_FENCE:
+                                contains_fence = true;
+                                break;
+                            case VNC_PSEUDO_CONTINUOUSUPDATES:
+                                contains_continuous = true;
+                                break;
+                            case VNC_PSEUDO_QEMUAUDIO:
+                                contains_audio = true;
+                                break;
+                        }
                     }
-                }
 
-                if (data_left >= expect_length)
-                {
                     if (contains_tight)
                     {
                         printf("HandleVNCMessage: Moving to Tight encoding at client request\n");
-                        server->encoding = VNC_TIGHT;
+                        picked = VNC_TIGHT;
                     }
-                    else
+
+                    pthread_mutex_lock(&server->lock);
+                    if (client->encoding != picked)
+                    {
+                        client->encoding = picked;
+                        client->encoding_changed = true;
+                    }
+
+                    // Both extensions are announced by sending the client
+                    // one of their messages, the first time it asks
+                    announce_fence = contains_fence && !client->fence_supported;
+                    announce_continuous = contains_continuous && contains_fence && !client->continuous_supported;
+                    client->fence_supported = contains_fence;
+                    client->continuous_supported = contains_continuous && contains_fence;
+                    client->copyrect_supported = contains_copyrect;
+                    if (!client->continuous_supported)
+                    {
+                        client->continuous = false;
+                    }
+
+                    // Audio is only offered when the game has some to give
+                    contains_audio = contains_audio && server->audio_ring != NULL;
+                    announce_audio = contains_audio && !client->audio_supported;
+                    client->audio_supported = contains_audio;
+                    if (!client->audio_supported)
+                    {
+                        client->audio_enabled = false;
+                    }
+                    pthread_mutex_unlock(&server->lock);
+
+                    if (announce_fence)
+                    {
+                        byte payload = 0;
+                        QueueFence(server, client, VNC_FENCE_REQUEST, &payload, 1);
+                    }
+
+                    if (announce_continuous)
+                    {
+                        byte end = VNC_SERVER_ENDOFCONTINUOUSUPDATES;
+                        printf("HandleVNCMessage: Offering continuous updates to client %d\n", (int) (client - server->clients));
+                        QueueControl(server, client, &end, 1);
+                    }
+
+                    if (announce_audio)
                     {
-                        server->encoding = VNC_RAW;
+                        // QEMU's extensions are acknowledged with an update
+                        // holding a single empty rectangle of their encoding
+                        byte ack[16] = {
+                            VNC_SERVER_FRAMEBUFFERUPDATE, 0, 0, 1,
+                            0, 0, 0, 0,
+                            server->width >> 8, server->width & 0xff,
+                            server->height >> 8, server->height & 0xff,
+                            (VNC_PSEUDO_QEMUAUDIO >> 24) & 0xff,
+                            (VNC_PSEUDO_QEMUAUDIO >> 16) & 0xff,
+                            (VNC_PSEUDO_QEMUAUDIO >> 8) & 0xff,
+                            VNC_PSEUDO_QEMUAUDIO & 0xff,
+                        };
+                        printf("HandleVNCMessage: Offering audio to client %d\n", (int) (client - server->clients));
+                        QueueControl(server, client, ack, sizeof(ack));
                     }
 
                     return message_scan_pos + expect_length;
@@ -215,7 +696,22 @@ static int HandleVNCMessage(vnc_server_t *server, int message_scan_pos, int* cur
         case VNC_CLIENT_FRAMEBUFFERUPDATEREQUEST:
             if (data_left >= 10)
             {
-                server->send_frame = 1;
+                // We always answer with whatever changed on the whole screen,
+                // the only part of the request we care about is whether the
+                // client still has the previous frame to build on
+                byte incremental = packet_base[1];
+
+                pthread_mutex_lock(&server->lock);
+                if (!incremental)
+                {
+                    client->full_refresh = true;
+                }
+
+                client->send_frame = 1;
+                pthread_mutex_unlock(&server->lock);
+
+                atomic_store(&server->frame_wanted, 1);
+                WakeSender(server);
                 return message_scan_pos + 10;
             }
             break;
@@ -407,7 +903,7 @@ static int HandleVNCMessage(vnc_server_t *server, int message_scan_pos, int* cur
                     // A key definition of some kind, but not one that maps to
                     // anything on a US layout, at least directly. Don't bother
                     // sending these along.
-                    if (!is_key_known)
+                    if (!is_key_known || !in_control)
                     {
                       return message_scan_pos + 8;
                     }
@@ -433,6 +929,8 @@ static int HandleVNCMessage(vnc_server_t *server, int message_scan_pos, int* cur
                     }
 
                     D_PostEvent(&event);
+                    FollowInput(server, client);
+                    RecordInput(server, client, packet_base, 8);
                     return message_scan_pos + 8;
                 }
 
@@ -451,6 +949,13 @@ static int HandleVNCMessage(vnc_server_t *server, int message_scan_pos, int* cur
 
                 if (data_left >= 6)
                 {
+                    if (!in_control)
+                    {
+                        return message_scan_pos + 6;
+                    }
+
+                    RecordInput(server, client, packet_base, 6);
+
                     *cursor_x = x_pos;
                     *cursor_y = y_pos;
                     *mouse_buttons = left_button
@@ -458,6 +963,7 @@ static int HandleVNCMessage(vnc_server_t *server, int message_scan_pos, int* cur
                         | (middle_button << 2)
                         | (scroll_up << 3)
                         | (scroll_down << 4);
+                    FollowInput(server, client);
 
                     // Defer this event so we can collect all mouse packets into a single event
                     return message_scan_pos + 6;
@@ -465,6 +971,169 @@ static int HandleVNCMessage(vnc_server_t *server, int message_scan_pos, int* cur
                 break;
             }
 
+        case VNC_CLIENT_ENABLECONTINUOUSUPDATES:
+            if (data_left >= 10)
+            {
+                // Like update requests, this names a region of the screen, but
+                // we always send whatever changed anywhere on it
+                byte enable = packet_base[1];
+                boolean supported;
+
+                pthread_mutex_lock(&server->lock);
+                supported = client->continuous_supported;
+                if (enable && supported && !client->continuous)
+                {
+                    // Nothing we pushed before is still on its way as far as
+                    // the flow control is concerned
+                    client->bytes_acked = client->bytes_sent;
+                }
+
+                client->continuous = enable && supported;
+                pthread_mutex_unlock(&server->lock);
+
+                if (enable && supported)
+                {
+                    printf("HandleVNCMessage: Client %d turned on continuous updates\n", (int) (client - server->clients));
+                    atomic_store(&server->frame_wanted, 1);
+                    WakeSender(server);
+                }
+                else if (!enable)
+                {
+                    // This tells the client that it won't get any more updates
+                    // it didn't ask for
+                    byte end = VNC_SERVER_ENDOFCONTINUOUSUPDATES;
+                    QueueControl(server, client, &end, 1);
+                }
+
+                return message_scan_pos + 10;
+            }
+            break;
+
+        case VNC_CLIENT_FENCE:
+            if (data_left >= 9)
+            {
+                uint32_t flags =
+                    (packet_base[4] << 24) |
+                    (packet_base[5] << 16) |
+                    (packet_base[6] << 8) |
+                    packet_base[7];
+                int length = packet_base[8];
+
+                if (length > VNC_FENCE_MAX_PAYLOAD)
+                {
+                    return -2;
+                }
+
+                if (data_left >= 9 + length)
+                {
+                    if (flags & VNC_FENCE_REQUEST)
+                    {
+                        // Messages are handled in order and the answer goes out
+                        // ahead of any update that could show the effects of
+                        // the ones after it, which is all that BlockBefore and
+                        // BlockAfter ask of us. We don't do SyncNext.
+                        QueueFence(server, client, flags & (VNC_FENCE_BLOCKBEFORE | VNC_FENCE_BLOCKAFTER), packet_base + 9, length);
+                    }
+                    else if (length == 8)
+                    {
+                        // The answer to a fence that followed a continuous
+                        // update. Anything else is the answer to the one that
+                        // announced fences, which tells us nothing new.
+                        AcknowledgeFence(server, client, packet_base + 9);
+                    }
+
+                    return message_scan_pos + 9 + length;
+                }
+            }
+            break;
+
+        case VNC_CLIENT_QEMU:
+            if (data_left >= 4)
+            {
+                int operation = (packet_base[2] << 8) | packet_base[3];
+                byte message[4] = {VNC_SERVER_QEMU, VNC_QEMU_AUDIO, 0, 0};
+                boolean supported;
+                boolean enabled;
+
+                // Audio is the only one of QEMU's messages we know
+                if (packet_base[1] != VNC_QEMU_AUDIO)
+                {
+                    return -2;
+                }
+
+                switch (operation)
+                {
+                    case VNC_QEMU_AUDIO_ENABLE:
+                        // The stream starts with whatever the game plays next
+                        pthread_mutex_lock(&server->lock);
+                        supported = client->audio_supported;
+                        pthread_mutex_unlock(&server->lock);
+
+                        if (supported)
+                        {
+                            printf("HandleVNCMessage: Client %d turned on audio\n", (int) (client - server->clients));
+                            message[3] = VNC_QEMU_AUDIO_BEGIN;
+                            QueueControl(server, client, message, 4);
+
+                            pthread_mutex_lock(&server->lock);
+                            client->audio_enabled = true;
+                            client->audio_read = server->audio_written;
+                            client->audio_frac = 0;
+                            pthread_mutex_unlock(&server->lock);
+                        }
+                        return message_scan_pos + 4;
+
+                    case VNC_QEMU_AUDIO_DISABLE:
+                        pthread_mutex_lock(&server->lock);
+                        enabled = client->audio_enabled;
+                        client->audio_enabled = false;
+                        pthread_mutex_unlock(&server->lock);
+
+                        if (enabled)
+                        {
+                            message[3] = VNC_QEMU_AUDIO_END;
+                            QueueControl(server, client, message, 4);
+                        }
+                        return message_scan_pos + 4;
+
+                    case VNC_QEMU_AUDIO_SETFORMAT:
+                        if (data_left >= 10)
+                        {
+                            int format = packet_base[4];
+                            int channels = packet_base[5];
+                            int frequency =
+                                (packet_base[6] << 24) |
+                                (packet_base[7] << 16) |
+                                (packet_base[8] << 8) |
+                                packet_base[9];
+
+                            if (format > VNC_AUDIO_S32
+                                || (channels != 1 && channels != 2)
+                                || frequency < VNC_AUDIO_MIN_FREQUENCY
+                                || frequency > VNC_AUDIO_MAX_FREQUENCY)
+                            {
+                                printf("HandleVNCMessage: Unsupported audio format: format %d, %d channels, %d Hz\n", format, channels, frequency);
+                                DropClient(server, client);
+                                return -3;
+                            }
+
+                            pthread_mutex_lock(&server->lock);
+                            client->audio_format = format;
+                            client->audio_channels = channels;
+                            client->audio_frequency = frequency;
+                            client->audio_frac = 0;
+                            pthread_mutex_unlock(&server->lock);
+
+                            return message_scan_pos + 10;
+                        }
+                        break;
+
+                    default:
+                        return -2;
+                }
+            }
+            break;
+
         case VNC_CLIENT_CLIENTCUTTEXT:
             // Length is dependent on data here, like SETENCODING
             if (data_left >= 8)
@@ -494,536 +1163,3170 @@ static int HandleVNCMessage(vnc_server_t *server, int message_scan_pos, int* cur
     return -1;
 }
 
-void VNC_Init(vnc_server_t* server, int width, int height)
+// Performs the step of the VNC handshake that the client is currently on, and
+// returns the position just after the data it used (or the same codes as
+// HandleVNCMessage). This is fairly simple, we just have to send over our
+// version string, auth info and initial state. A few things to watch out for:
+//
+// - The client sends a version lower than 3.8 (these have a different handshake mechanism, according
+//   to the RFC, which we don't want to support)
+//
+// - The client refuses to support non-authenticated connections.
+static int HandleHandshake(vnc_server_t *server, vnc_client_t *client, int message_scan_pos)
 {
-    server->send_frame = false;
-    server->server_packet = malloc(width * height * 32); // Allocate enough to fit even raw pixel data
-    server->text_input = false;
-    server->encoding = VNC_RAW;
-    server->palette = NULL;
-    server->mouse_x = 0;
-    server->mouse_y = 0;
-    server->width = width;
-    server->height = height;
+    byte* packet_base = client->client_packet + message_scan_pos;
+    int data_left = client->packet_cursor - message_scan_pos;
 
-    // Wait for a client to show up. Make sure we say something so that the
-    // user knows we're waiting for something and not just idling.
-    int server_sock = socket(AF_INET, SOCK_STREAM, 0);
+    switch (client->state)
+    {
+        case VNC_CLIENT_VERSION:
+            if (data_left < 12) return -1;
 
-    struct sockaddr_in listen_addr = {0};
-    listen_addr.sin_family = AF_INET;
-    listen_addr.sin_port = htons(5902);
-    listen_addr.sin_addr.s_addr = 0;
+            if (strncmp("RFB 003.008\n", packet_base, 12) != 0)
+            {
+                // Try to let the client know what's going on, if possible, before we kick them off
+                // (0 security types; 13-byte reason string)
+                SendAll(client->peer, "\x00\x00\x00\x00\x13Unsupported version", 18);
+                printf("HandleHandshake: Dropped client (invalid verstr: '%12.s')\n", packet_base);
+                DropClient(server, client);
+                return -3;
+            }
+
+            printf("HandleHandshake: Got good client version (%.11s)\n", packet_base);
+            // (1 security type; None)
+            if (SendAll(client->peer, "\x01\x01", 2))
+            {
+                printf("HandleHandshake: Dropped client (could not send auth types)\n");
+                DropClient(server, client);
+                return -3;
+            }
+
+            SetClientState(server, client, VNC_CLIENT_SECURITY);
+            return message_scan_pos + 12;
+
+        case VNC_CLIENT_SECURITY:
+            if (data_left < 1) return -1;
+
+            if (packet_base[0] != 1)
+            {
+                // The client chose an illegal auth type, somehow
+                // (status failed; 17-byte reason string)
+                SendAll(client->peer, "\x00\x00\x00\x01\x00\x00\x00\x11Illegal auth type", 25);
+                printf("HandleHandshake: Dropped client (illegal auth type: %d)\n", packet_base[0]);
+                DropClient(server, client);
+                return -3;
+            }
+
+            printf("HandleHandshake: Got good auth\n");
+
+            // (status successful)
+            if (SendAll(client->peer, "\x00\x00\x00\x00", 4))
+            {
+                printf("HandleHandshake: Dropped client (could not send auth success)\n");
+                DropClient(server, client);
+                return -3;
+            }
+
+            SetClientState(server, client, VNC_CLIENT_INIT);
+            return message_scan_pos + 1;
+
+        case VNC_CLIENT_INIT:
+            // The shared flag doesn't really matter since we share with
+            // everybody anyway
+            if (data_left < 1) return -1;
+
+            printf("HandleHandshake: Got client init\n");
+
+            byte server_init[28];
+            server_init[0] = (server->width >> 8) & 0xff; // Framebuffer width
+            server_init[1] = server->width & 0xff;
+            server_init[2] = (server->height >> 8) & 0xff; // Framebuffer height
+            server_init[3] = server->height & 0xff;
+            server_init[4] = 32; // Bits per pixel
+            server_init[5] = 24; // Depth
+            server_init[6] = 0; // Big-endian flag
+            server_init[7] = 1; // True color flag
+            server_init[8] = 0; // Red scale
+            server_init[9] = 255;
+            server_init[10] = 0; // Green scale
+            server_init[11] = 255;
+            server_init[12] = 0; // Blue scale
+            server_init[13] = 255;
+            server_init[14] = 16; // Red shift
+            server_init[15] = 8; // Green shift
+            server_init[16] = 0; // Blue shift
+            server_init[20] = 0; // Desktop name length
+            server_init[21] = 0;
+            server_init[22] = 0;
+            server_init[23] = 4;
+            server_init[24] = 'D'; // Desktop name
+            server_init[25] = 'O';
+            server_init[26] = 'O';
+            server_init[27] = 'M';
+
+            // At this point we've completed the handshake and have a working
+            // connection with the client. It may send some more initial
+            // configuration later but for the time being we can let the game continue.
+            if (SendAll(client->peer, server_init, 28))
+            {
+                printf("HandleHandshake: Dropped client (could not send server init)\n");
+                DropClient(server, client);
+                return -3;
+            }
+
+            SetClientState(server, client, VNC_CLIENT_ACTIVE);
+            if (server->controller == -1)
+            {
+                server->controller = client - server->clients;
+                printf("HandleHandshake: All done here, client %d has control\n", server->controller);
+            }
+            else
+            {
+                printf("HandleHandshake: All done here, client %d is spectating\n", (int) (client - server->clients));
+            }
+
+            return message_scan_pos + 1;
+
+        default:
+            break;
+    }
+
+    return -1;
+}
+
+// Reads whatever the client has sent us and handles all the complete messages
+// in it
+static void ReadClient(vnc_server_t *server, vnc_client_t *client, int* cursor_x, int* cursor_y, int* mouse_buttons)
+{
+    struct iovec piece;
+    union {
+        struct cmsghdr header;
+        byte data[CMSG_SPACE(sizeof(struct timespec))];
+    } control;
+    struct msghdr message = {0};
+    int chunk;
+    int old_scan_pos = 0;
+    int message_scan_pos = 0;
+
+    piece.iov_base = client->client_packet + client->packet_cursor;
+    piece.iov_len = VNC_PACKET_SIZE - client->packet_cursor;
+
+    message.msg_iov = &piece;
+    message.msg_iovlen = 1;
+    message.msg_control = &control;
+    message.msg_controllen = sizeof(control);
+
+    chunk = recvmsg(client->peer, &message, 0);
+    if (chunk <= 0)
+    {
+        printf("ReadClient: socket read failure\n");
+        DropClient(server, client);
+        return;
+    }
+
+    client->packet_cursor += chunk;
+
+    // Input from this read is counted as arriving when the last of it did,
+    // or just now if we can't tell
+    server->read_time = GetTimeUS();
+    server->read_arrived = server->read_time;
+
+#ifdef VNC_HAVE_ARRIVAL_TIME
+    for (struct cmsghdr* header = CMSG_FIRSTHDR(&message); header != NULL; header = CMSG_NXTHDR(&message, header))
+    {
+        if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            // The kernel's time is by the wall clock rather than ours
+            struct timespec arrived, now;
+            int64_t waited;
+
+            memcpy(&arrived, CMSG_DATA(header), sizeof(arrived));
+            clock_gettime(CLOCK_REALTIME, &now);
+
+            waited = (int64_t) (now.tv_sec - arrived.tv_sec) * 1000000
+                   + (now.tv_nsec - arrived.tv_nsec) / 1000;
+            if (waited > 0)
+            {
+                server->read_arrived -= waited;
+            }
+        }
+    }
+#endif
+
+    while (message_scan_pos >= 0)
+    {
+        old_scan_pos = message_scan_pos;
+        if (client->state == VNC_CLIENT_ACTIVE)
+        {
+            message_scan_pos = HandleVNCMessage(server, client, message_scan_pos, cursor_x, cursor_y, mouse_buttons);
+        }
+        else
+        {
+            message_scan_pos = HandleHandshake(server, client, message_scan_pos);
+        }
+    }
+
+    if (message_scan_pos == -3)
+    {
+        return;
+    }
+
+    if (message_scan_pos == -2)
+    {
+        printf("ReadClient: Flushing buffer after unknown message\n");
+        client->packet_cursor = 0;
+    }
+    else
+    {
+        FinalizeVNCMessages(client, old_scan_pos);
+    }
+}
+
+// Picks up anybody waiting on the listening socket and starts their handshake
+static void AcceptClients(vnc_server_t *server)
+{
+    while (1)
+    {
+        int peer = accept(server->listener, NULL, NULL);
+        vnc_client_t* client = NULL;
+#ifdef VNC_HAVE_ZEROCOPY
+        int zerocopy = 1;
+#endif
+#ifdef VNC_HAVE_ARRIVAL_TIME
+        int timestamps = 1;
+#endif
+        if (peer == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                printf("AcceptClients: Failed to acquire client (%s)\n", strerror(errno));
+            }
+
+            return;
+        }
+
+        // Slots of dropped clients only become free once the sender has
+        // closed them
+        pthread_mutex_lock(&server->lock);
+        for (int i = 0; i < VNC_MAX_CLIENTS; i++)
+        {
+            if (server->clients[i].state == VNC_CLIENT_FREE)
+            {
+                client = &server->clients[i];
+                break;
+            }
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        if (client == NULL)
+        {
+            printf("AcceptClients: Dropped client (too many clients)\n");
+            close(peer);
+            continue;
+        }
+
+        // Some platforms hand out sockets that inherit the listener's
+        // non-blocking mode, which the handshake doesn't expect
+        fcntl(peer, F_SETFL, 0);
+
+        if (SendAll(peer, "RFB 003.008\n", 12))
+        {
+            printf("AcceptClients: Dropped client (could not send verstr)\n");
+            close(peer);
+            continue;
+        }
+
+        client->peer = peer;
+        client->packet_cursor = 0;
+        client->dead = false;
+        client->released = false;
+        client->send_frame = false;
+        client->full_refresh = true;
+        client->encoding = VNC_RAW;
+        client->encoding_changed = false;
+        client->pixel_format = VNC_TRUECOLOR;
+        client->pixel_format_changed = false;
+        client->fence_supported = false;
+        client->continuous_supported = false;
+        client->copyrect_supported = false;
+        client->continuous = false;
+        client->audio_supported = false;
+        client->audio_enabled = false;
+        client->audio_format = VNC_AUDIO_S16;
+        client->audio_channels = 2;
+        client->audio_frequency = 44100;
+        client->audio_read = 0;
+        client->audio_frac = 0;
+        client->control_size = 0;
+        client->bytes_sent = 0;
+        client->bytes_acked = 0;
+        client->backoff_mark = 0;
+        client->window = VNC_WINDOW_START;
+        client->min_rtt = -1;
+        client->rate = VNC_DEFAULT_RATE;
+        client->write_ms = 0;
+        client->written = 0;
+        client->backlog = 0;
+        client->sample_time = GetTimeMS();
+        client->sample_delivered = 0;
+        client->sample_busy = false;
+        client->dropped = 0;
+        client->dropped_seq = -1;
+        client->encoder = -1;
+        client->out = NULL;
+        client->out_offset = 0;
+        client->zerocopy = false;
+        client->zerocopy_count = 0;
+        client->zerocopy_next = 0;
+        client->probe.client = -1;
+
+#ifdef VNC_HAVE_ZEROCOPY
+        client->zerocopy = server->zerocopy
+                        && setsockopt(peer, SOL_SOCKET, SO_ZEROCOPY, &zerocopy, sizeof(zerocopy)) == 0;
+#endif
+
+#ifdef VNC_HAVE_ARRIVAL_TIME
+        if (server->show_stats)
+        {
+            setsockopt(peer, SOL_SOCKET, SO_TIMESTAMPNS, &timestamps, sizeof(timestamps));
+        }
+#endif
+
+        SetClientState(server, client, VNC_CLIENT_VERSION);
+        printf("AcceptClients: Got connection, starting handshake\n");
+    }
+}
+
+// Waits up to the given number of milliseconds for anybody to connect or for
+// any of the clients to send us something, and reads it
+static int PollClients(vnc_server_t *server, int timeout, int* cursor_x, int* cursor_y, int* mouse_buttons)
+{
+    struct pollfd fds[VNC_MAX_CLIENTS + 1];
+    vnc_client_t* polled[VNC_MAX_CLIENTS + 1];
+    int count = 1;
+    int events;
+
+    fds[0].fd = server->listener;
+    fds[0].events = POLLIN;
+
+    // The game thread can only read from clients it hasn't released to the
+    // sender, and once they're released they aren't its to look at
+    for (int i = 0; i < VNC_MAX_CLIENTS; i++)
+    {
+        vnc_client_t* client = &server->clients[i];
+        if (!client->released && client->state != VNC_CLIENT_FREE)
+        {
+            fds[count].fd = client->peer;
+            fds[count].events = POLLIN;
+            polled[count] = client;
+            count++;
+        }
+    }
+
+    events = poll(fds, count, timeout);
+    if (events == -1)
+    {
+        if (errno != EINTR)
+        {
+            printf("PollClients: Could not poll (%s)\n", strerror(errno));
+        }
+
+        return -1;
+    }
+
+    if (fds[0].revents != 0)
+    {
+        AcceptClients(server);
+    }
+
+    for (int i = 1; i < count; i++)
+    {
+        if (fds[i].revents != 0)
+        {
+            ReadClient(server, polled[i], cursor_x, cursor_y, mouse_buttons);
+        }
+    }
+
+    return events;
+}
+
+static void* SenderThread(void* arg);
+static void PickKernels(void);
+
+// Sets up everything the server needs to encode frames, short of the
+// network and the sender thread
+static void InitServer(vnc_server_t* server, int width, int height)
+{
+    int tile_count;
+
+    PickKernels();
+
+    server->text_input = false;
+    server->have_palette = false;
+    server->tiles_x = (width + VNC_TILE_SIZE - 1) / VNC_TILE_SIZE;
+    server->tiles_y = (height + VNC_TILE_SIZE - 1) / VNC_TILE_SIZE;
+
+    // The biggest update we can send is a new color map followed by a copy
+    // for every move and a rectangle for every tile, each with Tight's longest
+    // header, palette and zlib overhead, and then every pixel in true color.
+    // That's also more than Tight's data can come to, even when it's stored.
+    // Each rectangle's data is at most a piece per row, plus one on either
+    // side.
+    tile_count = server->tiles_x * server->tiles_y;
+    server->update_capacity = 6 + 256 * 6 + 4
+                            + VNC_MAX_MOVES * 16
+                            + tile_count * (12 + 3 + 256 * 3 + 3 + 64)
+                            + width * height * 4;
+    server->piece_capacity = 1 + tile_count * (VNC_TILE_SIZE + 2);
+    server->spare_count = 0;
+    server->building = NULL;
+    server->server_packet = NULL;
+    server->dirty_tiles = malloc(server->tiles_x * server->tiles_y);
+    server->rects = malloc(server->tiles_x * server->tiles_y * 4 * sizeof(int));
+    server->rect_count = 0;
+    server->copy_count = 0;
+    server->moved_frame = malloc(width * height);
+    server->tight_indices = malloc(width * height);
+    server->mouse_x = 0;
+    server->mouse_y = 0;
+    server->width = width;
+    server->height = height;
+
+    for (int i = 0; i < 3; i++)
+    {
+        server->frames[i].pixels = malloc(width * height);
+        server->frames[i].move_count = 0;
+        server->frames[i].probe.client = -1;
+    }
+
+    memset(server->latency, 0, sizeof(server->latency));
+    server->probe.client = -1;
+    server->frame_probe.client = -1;
+
+    server->next_move_count = 0;
+
+    server->back_frame = 0;
+    atomic_init(&server->ready_frame, 1);
+    server->front_frame = 2;
+    server->have_frame = false;
+    server->frame_seq = 0;
+    server->stats_time = GetTimeMS();
+    atomic_init(&server->sender_failed, 0);
+    atomic_init(&server->shutting_down, 0);
+    atomic_init(&server->frame_wanted, 0);
+    server->sender_running = false;
+    pthread_mutex_init(&server->lock, NULL);
+
+    server->audio_ring = NULL;
+    server->audio_written = 0;
+    if (server->audio_rate > 0)
+    {
+        server->audio_ring = malloc(VNC_AUDIO_RING * 2 * sizeof(int16_t));
+    }
+
+#ifndef VNC_HAVE_ZEROCOPY
+    if (server->zerocopy)
+    {
+        printf("VNC_Init: Zero-copy sends aren't supported here, copying instead\n");
+        server->zerocopy = false;
+    }
+#endif
+
+    server->controller = -1;
+    for (int i = 0; i < VNC_MAX_CLIENTS; i++)
+    {
+        server->clients[i].state = VNC_CLIENT_FREE;
+        server->clients[i].released = false;
+        server->clients[i].encoder = -1;
+        server->clients[i].out = NULL;
+
+        // Encoders get their buffers the first time they're used
+        server->encoders[i].members = 0;
+        server->encoders[i].last_frame = NULL;
+    }
+}
+
+void VNC_Init(vnc_server_t* server, int width, int height, const char* address, int port)
+{
+    struct sockaddr_in listen_addr = {0};
+    int reuse = 1;
+
+    InitServer(server, width, height);
+
+    server->record = NULL;
+    server->record_frame = NULL;
+    if (server->record_path != NULL)
+    {
+        StartRecording(server);
+    }
+
+    if (pipe(server->wake_pipe) != 0)
+    {
+        I_Error("VNC_Init: Could not create sender pipe (%s)", strerror(errno));
+    }
+
+    fcntl(server->wake_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(server->wake_pipe[1], F_SETFL, O_NONBLOCK);
+
+    listen_addr.sin_family = AF_INET;
+    listen_addr.sin_port = htons(port);
+    listen_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if (address[0] != '\0' && inet_pton(AF_INET, address, &listen_addr.sin_addr) != 1)
+    {
+        I_Error("VNC_Init: Invalid address '%s'", address);
+    }
+
+    server->listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (server->listener == -1)
+    {
+        I_Error("VNC_Init: Could not create listener (%s)", strerror(errno));
+    }
+
+    // Let a restarted game have its port back without waiting for the old
+    // connections to time out
+    setsockopt(server->listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    if (bind(server->listener, (const struct sockaddr*) &listen_addr, sizeof(struct sockaddr_in)) != 0
+        || listen(server->listener, VNC_MAX_CLIENTS) != 0)
+    {
+        I_Error("VNC_Init: Could not listen on %s:%d (%s)",
+                address[0] != '\0' ? address : "*", port, strerror(errno));
+    }
+
+    // Clients are picked up while the game is running, which can't wait
+    // around for them to connect
+    fcntl(server->listener, F_SETFL, O_NONBLOCK);
+    printf("VNC_Init: Listening on %s:%d\n", address[0] != '\0' ? address : "*", port);
+
+    if (pthread_create(&server->sender, NULL, SenderThread, server) != 0)
+    {
+        I_Error("VNC_Init: Could not start sender thread");
+    }
+
+    server->sender_running = true;
+}
+
+void VNC_SetTextInput(vnc_server_t* server, boolean state)
+{
+    server->text_input = state;
+}
+
+void VNC_PumpMessages(vnc_server_t* server)
+{
+    // Return immediately, only pull the data that's buffered
+    int events = 0;
+
+    // Collapse several cursor movement packets into a single event
+    int new_mouse_x = -1;
+    int new_mouse_y = -1;
+    int mouse_buttons = -1;
+
+    if (atomic_load(&server->sender_failed))
+    {
+        // The sender can't shut down the game itself since it would be waiting
+        // on itself to finish, so it leaves that for us
+        printf("VNC_PumpMessages: sender stopped unexpectedly\n");
+        VNC_Exit(server);
+        I_Quit();
+        return;
+    }
+
+    // Let go of any clients that the sender couldn't write to, so that it can
+    // close them. The game carries on without anybody watching.
+    pthread_mutex_lock(&server->lock);
+    for (int i = 0; i < VNC_MAX_CLIENTS; i++)
+    {
+        vnc_client_t* client = &server->clients[i];
+        if (client->released || client->state != VNC_CLIENT_ACTIVE)
+        {
+            continue;
+        }
+
+        if (client->dead)
+        {
+            client->released = true;
+            if (server->controller == i)
+            {
+                server->controller = -1;
+            }
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    if (server->controller == -1)
+    {
+        // The player left, so hand the controls to whoever's been watching
+        for (int i = 0; i < VNC_MAX_CLIENTS; i++)
+        {
+            vnc_client_t* client = &server->clients[i];
+            if (!client->released && client->state == VNC_CLIENT_ACTIVE)
+            {
+                server->controller = i;
+                printf("VNC_PumpMessages: Client %d now has control\n", i);
+                break;
+            }
+        }
+    }
+
+    do {
+        events = PollClients(server, 0, &new_mouse_x, &new_mouse_y, &mouse_buttons);
+    } while (events > 0);
+
+    if (new_mouse_x != -1)
+    {
+        event_t event;
+        event.type = ev_mouse;
+        event.data1 = mouse_buttons;
+        event.data2 = new_mouse_x - server->mouse_x;
+        event.data3 = new_mouse_y - server->mouse_y;
+        D_PostEvent(&event);
+
+        server->mouse_x = new_mouse_x;
+        server->mouse_y = new_mouse_y;
+    }
+}
+
+void VNC_PreparePalette(vnc_server_t* server, rgb_t* palette)
+{
+    // The palette is usually function scoped and loaded from a cached lump, so
+    // it's not guaranteed to be around later on. Make sure we copy it.
+    int offset = 0;
+    for (int i = 0; i < 256; i++)
+    {
+        // True color clients get 32-bit little-endian pixels, which is blue,
+        // green, red and then padding in memory
+        byte color[4] = {palette[i].b, palette[i].g, palette[i].r, 0};
+
+        server->next_palette[offset++] = palette[i].r;
+        server->next_palette[offset++] = palette[i].g;
+        server->next_palette[offset++] = palette[i].b;
+        memcpy(&server->next_colors[i], color, 4);
+    }
+
+    server->have_palette = true;
+
+    if (server->record != NULL)
+    {
+        RecordPalette(server);
+    }
+}
+
+static void AddDirtyRect(vnc_server_t* server, int x, int y, int w, int h)
+{
+    int* rect = server->rects + server->rect_count * 4;
+    rect[0] = x;
+    rect[1] = y;
+    rect[2] = w;
+    rect[3] = h;
+    server->rect_count++;
+}
+
+// Covers the whole screen. True color Tight clients get it in bands, each on
+// a zlib stream of its own, so that the next time the whole screen has to go
+// out each band can be compressed against the copy that went out before. When
+// only the palette has changed that's almost all of it, leaving not much more
+// than the colors themselves to send.
+static void AddScreenRects(vnc_server_t* server, vnc_encoder_t* encoder)
+{
+    int band_height = (server->height + VNC_TIGHT_BANDS - 1) / VNC_TIGHT_BANDS;
+
+    if (encoder->encoding != VNC_TIGHT || encoder->pixel_format != VNC_TRUECOLOR)
+    {
+        AddDirtyRect(server, 0, 0, server->width, server->height);
+        return;
+    }
+
+    if (!encoder->tight_bands_ready)
+    {
+        for (int i = 1; i < VNC_TIGHT_STREAMS; i++)
+        {
+            DEFLATE_Init(&encoder->tight_streams[i]);
+        }
+
+        encoder->tight_bands_ready = true;
+    }
+
+    for (int y = 0; y < server->height; y += band_height)
+    {
+        int h = server->height - y < band_height ? server->height - y : band_height;
+        AddDirtyRect(server, 0, y, server->width, h);
+    }
+
+    server->rects_banded = true;
+}
+
+// Compares the frame against base, which is what the encoder's clients will
+// have once they've made any copies, and
+// fills in the list of rectangles that need to be sent to bring them up to date. This is done
+// in tiles rather than pixels; most of what Doom draws (the status bar, menus,
+// the intermission screen) either doesn't change at all or changes within a
+// small area, and tiles keep the number of rectangles (and their overhead) low.
+static void FindDirtyRects(vnc_server_t* server, vnc_encoder_t* encoder, byte* frame, byte* base, boolean full_refresh)
+{
+    int row_start = 0;
+
+    server->rect_count = 0;
+    server->rects_banded = false;
+
+    if (full_refresh)
+    {
+        AddScreenRects(server, encoder);
+        return;
+    }
+
+    for (int ty = 0; ty < server->tiles_y; ty++)
+    {
+        int y = ty * VNC_TILE_SIZE;
+        int h = server->height - y < VNC_TILE_SIZE ? server->height - y : VNC_TILE_SIZE;
+
+        for (int tx = 0; tx < server->tiles_x; tx++)
+        {
+            int x = tx * VNC_TILE_SIZE;
+            int w = server->width - x < VNC_TILE_SIZE ? server->width - x : VNC_TILE_SIZE;
+            int row_offset = y * server->width + x;
+            boolean dirty = false;
+
+            for (int row = 0; row < h; row++)
+            {
+                if (memcmp(frame + row_offset, base + row_offset, w) != 0)
+                {
+                    dirty = true;
+                    break;
+                }
+
+                row_offset += server->width;
+            }
+
+            server->dirty_tiles[ty * server->tiles_x + tx] = dirty;
+        }
+    }
+
+    // Join runs of dirty tiles on each row into a single rectangle, and then
+    // join that rectangle onto one directly above it if they cover the same
+    // columns. This won't find the smallest set of rectangles but it does well
+    // enough on the kinds of changes we see, which tend to be one big block
+    // (the 3D view) or a few small ones (status bar numbers, the menu skull).
+    for (int ty = 0; ty < server->tiles_y; ty++)
+    {
+        int y = ty * VNC_TILE_SIZE;
+        int h = server->height - y < VNC_TILE_SIZE ? server->height - y : VNC_TILE_SIZE;
+        int prev_row_start = row_start;
+        int prev_row_end = server->rect_count;
+        int tx = 0;
+
+        row_start = server->rect_count;
+
+        while (tx < server->tiles_x)
+        {
+            int run_start = tx;
+            int x;
+            int w;
+            boolean merged = false;
+
+            if (!server->dirty_tiles[ty * server->tiles_x + tx])
+            {
+                tx++;
+                continue;
+            }
+
+            while (tx < server->tiles_x && server->dirty_tiles[ty * server->tiles_x + tx])
+            {
+                tx++;
+            }
+
+            x = run_start * VNC_TILE_SIZE;
+            w = tx * VNC_TILE_SIZE;
+            if (w > server->width)
+            {
+                w = server->width;
+            }
+            w -= x;
+
+            for (int i = prev_row_start; i < prev_row_end; i++)
+            {
+                int* rect = server->rects + i * 4;
+                if (rect[0] == x && rect[2] == w && rect[1] + rect[3] == y)
+                {
+                    rect[3] += h;
+                    merged = true;
+                    break;
+                }
+            }
+
+            if (!merged)
+            {
+                AddDirtyRect(server, x, y, w, h);
+            }
+        }
+
+        // Rectangles that were extended from the previous row are still open
+        // for the next one, so keep them in the search window
+        for (int i = prev_row_start; i < prev_row_end; i++)
+        {
+            int* rect = server->rects + i * 4;
+            if (rect[1] + rect[3] == y + h)
+            {
+                row_start = i;
+                break;
+            }
+        }
+    }
+}
+
+// Works out which of the moves the game hinted at would bring the encoder's
+// clients closer to the frame. A move is only used if most of the rows it
+// copies are exactly what the frame has where they end up. Hints that don't
+// hold for these clients, usually because they skipped a frame, are left for
+// the dirty rectangles, as are the parts of the ones we use that had
+// something drawn over them. Returns what the clients will have once they've
+// made the copies.
+static byte* ApplyMoves(vnc_server_t* server, vnc_encoder_t* encoder, vnc_frame_t* frame)
+{
+    byte* moved = server->moved_frame;
+    int width = server->width;
+
+    server->copy_count = 0;
+    memcpy(moved, encoder->last_frame->pixels, width * server->height);
+
+    // Clients make the copies one after another, so each move is checked
+    // against the screen as the ones before it leave it
+    for (int m = 0; m < frame->move_count; m++)
+    {
+        vnc_move_t* move = &frame->moves[m];
+        int matched = 0;
+        for (int row = 0; row < move->h; row++)
+        {
+            if (memcmp(moved + (move->src_y + row) * width + move->src_x,
+                       frame->pixels + (move->y + row) * width + move->x,
+                       move->w) == 0)
+            {
+                matched++;
+            }
+        }
+
+        if (matched * 2 <= move->h)
+        {
+            continue;
+        }
+
+        // Copy the rows in whichever order doesn't overwrite any before
+        // they've been copied themselves
+        for (int i = 0; i < move->h; i++)
+        {
+            int row = move->y > move->src_y ? move->h - 1 - i : i;
+            memmove(moved + (move->y + row) * width + move->x,
+                    moved + (move->src_y + row) * width + move->src_x,
+                    move->w);
+        }
+
+        server->copies[server->copy_count++] = *move;
+    }
+
+    return server->copy_count > 0 ? moved : encoder->last_frame->pixels;
+}
+
+static void ReleasePixels(vnc_pixels_t* pixels)
+{
+    if (--pixels->refs == 0)
+    {
+        free(pixels->pixels);
+        free(pixels);
+    }
+}
+
+// Makes sure that no update is pointing into the encoder's copy of the
+// frame, so that it can be written to. If one is, the update keeps it and
+// the encoder moves on to a new one.
+static void OwnLastFrame(vnc_server_t* server, vnc_encoder_t* encoder)
+{
+    if (encoder->last_frame != NULL && encoder->last_frame->refs == 1)
+    {
+        return;
+    }
+
+    if (encoder->last_frame != NULL)
+    {
+        ReleasePixels(encoder->last_frame);
+    }
+
+    encoder->last_frame = malloc(sizeof(vnc_pixels_t));
+    encoder->last_frame->pixels = malloc(server->width * server->height);
+    encoder->last_frame->refs = 1;
+}
+
+// Gets an empty update, reusing a spare one if there is one
+static vnc_update_t* NewUpdate(vnc_server_t* server)
+{
+    vnc_update_t* update;
+    if (server->spare_count > 0)
+    {
+        update = server->spare_updates[--server->spare_count];
+    }
+    else
+    {
+        update = malloc(sizeof(vnc_update_t));
+        update->data = malloc(server->update_capacity);
+        update->pieces = malloc(server->piece_capacity * sizeof(struct iovec));
+    }
+
+    update->piece_count = 0;
+    update->size = 0;
+    update->pixels = NULL;
+    update->refs = 0;
+    return update;
+}
+
+// Drops a reference to the update, which is kept as a spare once nobody is
+// using it
+static void ReleaseUpdate(vnc_server_t* server, vnc_update_t* update)
+{
+    if (--update->refs > 0)
+    {
+        return;
+    }
+
+    if (update->pixels != NULL)
+    {
+        ReleasePixels(update->pixels);
+        update->pixels = NULL;
+    }
+
+    if (server->spare_count < VNC_SPARE_UPDATES)
+    {
+        server->spare_updates[server->spare_count++] = update;
+        return;
+    }
+
+    free(update->data);
+    free(update->pieces);
+    free(update);
+}
+
+// Starts building the update, after which everything written to
+// server_packet goes into its buffer
+static void BeginUpdate(vnc_server_t* server, vnc_update_t* update)
+{
+    server->building = update;
+    server->server_packet = update->data;
+    server->piece_start = 0;
+}
+
+static void AddPiece(vnc_server_t* server, byte* data, int length)
+{
+    vnc_update_t* update = server->building;
+    if (length == 0)
+    {
+        return;
+    }
+
+    // Pieces that follow on from each other are sent as one
+    if (update->piece_count > 0)
+    {
+        struct iovec* last = &update->pieces[update->piece_count - 1];
+        if ((byte*) last->iov_base + last->iov_len == data)
+        {
+            last->iov_len += length;
+            update->size += length;
+            return;
+        }
+    }
+
+    if (update->piece_count == server->piece_capacity)
+    {
+        I_Error("AddPiece: Update has too many pieces");
+    }
+
+    update->pieces[update->piece_count].iov_base = data;
+    update->pieces[update->piece_count].iov_len = length;
+    update->piece_count++;
+    update->size += length;
+}
+
+// Ends the piece of the update that's been written to server_packet since
+// the last one, which runs up to offset. The next piece starts at next,
+// which can be further on to skip space that turned out not to be needed.
+static void EndPiece(vnc_server_t* server, int offset, int next)
+{
+    AddPiece(server, server->server_packet + server->piece_start, offset - server->piece_start);
+    server->piece_start = next;
+}
+
+// Adds pixels to the update that are sent straight out of the encoder's copy
+// of the frame instead of being copied into the update
+static void AddFramePiece(vnc_server_t* server, vnc_encoder_t* encoder, int offset, byte* pixels, int length)
+{
+    EndPiece(server, offset, offset);
+    AddPiece(server, pixels, length);
+
+    if (server->building->pixels == NULL)
+    {
+        server->building->pixels = encoder->last_frame;
+        encoder->last_frame->refs++;
+    }
+}
+
+static int WriteRectHeader(vnc_server_t* server, int offset, int* rect, vnc_encoding_t encoding)
+{
+    server->server_packet[offset++] = (rect[0] >> 8) & 0xff; // X coordinate
+    server->server_packet[offset++] = rect[0] & 0xff;
+    server->server_packet[offset++] = (rect[1] >> 8) & 0xff; // Y coordinate
+    server->server_packet[offset++] = rect[1] & 0xff;
+    server->server_packet[offset++] = (rect[2] >> 8) & 0xff; // Width
+    server->server_packet[offset++] = rect[2] & 0xff;
+    server->server_packet[offset++] = (rect[3] >> 8) & 0xff; // Height
+    server->server_packet[offset++] = rect[3] & 0xff;
+    server->server_packet[offset++] = (encoding >> 24) & 0xff; // Encoding type
+    server->server_packet[offset++] = (encoding >> 16) & 0xff;
+    server->server_packet[offset++] = (encoding >> 8) & 0xff;
+    server->server_packet[offset++] = encoding & 0xff;
+    return offset;
+}
+
+// Starts a framebuffer update, which opens with any copies so that the
+// clients have moved everything before the rectangles are drawn over it
+static int WriteFramebufferUpdateHeader(vnc_server_t* server, int offset)
+{
+    int count = server->copy_count + server->rect_count;
+    server->server_packet[offset++] = VNC_SERVER_FRAMEBUFFERUPDATE;
+    offset++; // Padding
+    server->server_packet[offset++] = (count >> 8) & 0xff; // Number of rectangles
+    server->server_packet[offset++] = count & 0xff;
+
+    for (int c = 0; c < server->copy_count; c++)
+    {
+        vnc_move_t* copy = &server->copies[c];
+        int rect[4] = {copy->x, copy->y, copy->w, copy->h};
+        offset = WriteRectHeader(server, offset, rect, VNC_COPYRECT);
+        server->server_packet[offset++] = (copy->src_x >> 8) & 0xff;
+        server->server_packet[offset++] = copy->src_x & 0xff;
+        server->server_packet[offset++] = (copy->src_y >> 8) & 0xff;
+        server->server_packet[offset++] = copy->src_y & 0xff;
+    }
+
+    return offset;
+}
+
+// Writes out the whole palette as the client's color map. Each component is
+// 16 bits, so ours are scaled up to fill the range.
+static int WriteColorMapEntries(vnc_server_t* server, vnc_encoder_t* encoder, int offset)
+{
+    server->server_packet[offset++] = VNC_SERVER_SETCOLORMAPENTRIES;
+    offset++; // Padding
+    server->server_packet[offset++] = 0; // First color
+    server->server_packet[offset++] = 0;
+    server->server_packet[offset++] = 1; // Number of colors
+    server->server_packet[offset++] = 0;
+
+    for (int i = 0; i < 256 * 3; i++)
+    {
+        server->server_packet[offset++] = encoder->palette[i];
+        server->server_packet[offset++] = encoder->palette[i];
+    }
+
+    return offset;
+}
+
+// Turns palette indices into the 32-bit pixels they stand for, by way of a
+// table of all 256 of them
+static void ExpandPixelsScalar(byte* out, const byte* in, const uint32_t* colors, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        memcpy(out + i * 4, &colors[in[i]], 4);
+    }
+}
+
+#ifdef VNC_HAVE_AVX2
+// Looks up eight pixels at a time. SSE2 has no way of doing the lookups
+// themselves, and comes out no faster than the scalar version.
+__attribute__((target("avx2")))
+static void ExpandPixelsAVX2(byte* out, const byte* in, const uint32_t* colors, int count)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i indices = _mm_loadl_epi64((const __m128i*) (in + i));
+        __m256i pixels = _mm256_i32gather_epi32((const int*) colors, _mm256_cvtepu8_epi32(indices), 4);
+        _mm256_storeu_si256((__m256i*) (out + i * 4), pixels);
+    }
+
+    ExpandPixelsScalar(out + i * 4, in + i, colors, count - i);
+}
+#endif
+
+static void (*ExpandPixels)(byte* out, const byte* in, const uint32_t* colors, int count) = ExpandPixelsScalar;
+
+// Picks the fastest kernels the processor can run
+static void PickKernels(void)
+{
+#ifdef VNC_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        printf("PickKernels: Using AVX2 pixel expansion\n");
+        ExpandPixels = ExpandPixelsAVX2;
+    }
+#endif
+}
+
+static int EncodeRawUpdate(vnc_server_t* server, vnc_encoder_t* encoder, byte* frame, int offset)
+{
+    offset = WriteFramebufferUpdateHeader(server, offset);
+
+    for (int r = 0; r < server->rect_count; r++)
+    {
+        int* rect = server->rects + r * 4;
+        offset = WriteRectHeader(server, offset, rect, VNC_RAW);
+
+        // Color map clients take the indices just as we have them, so
+        // they're sent without being copied. Rectangles as wide as the screen
+        // go out in one piece.
+        if (encoder->pixel_format == VNC_COLORMAP)
+        {
+            byte* pixels = encoder->last_frame->pixels;
+            for (int y = rect[1]; y < rect[1] + rect[3]; y++)
+            {
+                AddFramePiece(server, encoder, offset, pixels + y * server->width + rect[0], rect[2]);
+            }
+
+            continue;
+        }
+
+        for (int y = rect[1]; y < rect[1] + rect[3]; y++)
+        {
+            ExpandPixels(server->server_packet + offset, frame + y * server->width + rect[0], encoder->colors, rect[2]);
+            offset += rect[2] * 4;
+        }
+    }
+
+    return offset;
+}
+
+// Writes out the Tight compact representation of a length, which takes up
+// between one and three bytes depending upon how large the length is
+static int WriteTightLength(vnc_server_t* server, int offset, int length)
+{
+    if (length < 0x80)
+    {
+        server->server_packet[offset++] = length;
+    }
+    else if (length < 0x4000)
+    {
+        server->server_packet[offset++] = (1 << 7) | (length & 0x7f);
+        server->server_packet[offset++] = (length >> 7) & 0x7f;
+    }
+    else
+    {
+        server->server_packet[offset++] = (1 << 7) | (length & 0x7f);
+        server->server_packet[offset++] = (1 << 7) | ((length >> 7) & 0x7f);
+        server->server_packet[offset++] = (length >> 14) & 0xff;
+    }
+
+    return offset;
+}
+
+static int WriteTightRect(vnc_server_t* server, vnc_encoder_t* encoder, int offset, byte* frame, int* rect, int stream, boolean stored)
+{
+    // Tight encoding is a compressed encoding that supports various options,
+    // including JPEG encoding, palettes and gradients. The only thing we care
+    // about here is palette support; Tight encoding supports palettes of up to
+    // 256 colors which is exactly the size we need to use the frame data with
+    // little modification. See github.com/rfbproto/rfbproto for documentation.
+    // RFC 6143 doesn't describe this encoding.
+    //
+    // Each rectangle gets its own palette made up of only the colors that
+    // appear within it. The full 768-byte palette would otherwise dwarf the
+    // small rectangles we get from incremental updates. A single color can
+    // be sent as a fill, which doesn't need any pixel data at all.
+    //
+    // Color map clients are sent pixels as single bytes holding our own
+    // indices, so a palette is only worth it when it lets us pack two colors
+    // into bits.
+    boolean colormap = encoder->pixel_format == VNC_COLORMAP;
+    byte used[256];
+    byte remap[256];
+    int color_count = 0;
+    int control_offset;
+    boolean use_palette;
+    int data_size = 0;
+    byte* indices = server->tight_indices;
+    deflate_stream_t* zstream = &encoder->tight_streams[stream];
+    int zlib_offset;
+    int zlib_data_size;
+
+    memset(used, 0, sizeof(used));
+    for (int y = rect[1]; y < rect[1] + rect[3]; y++)
+    {
+        byte* row = frame + y * server->width + rect[0];
+        for (int x = 0; x < rect[2]; x++)
+        {
+            used[row[x]] = 1;
+        }
+    }
+
+    for (int i = 0; i < 256; i++)
+    {
+        if (used[i])
+        {
+            remap[i] = color_count++;
+        }
+    }
+
+    offset = WriteRectHeader(server, offset, rect, VNC_TIGHT);
+
+    if (color_count == 1)
+    {
+        // Fill compression, followed by the single color in RGB order
+        int index = frame[rect[1] * server->width + rect[0]];
+        server->server_packet[offset++] = 0x80;
+        if (colormap)
+        {
+            server->server_packet[offset++] = index;
+            return offset;
+        }
+
+        server->server_packet[offset++] = encoder->palette[index * 3];
+        server->server_packet[offset++] = encoder->palette[index * 3 + 1];
+        server->server_packet[offset++] = encoder->palette[index * 3 + 2];
+        return offset;
+    }
+
+    // Always use basic compression which contains pixel data. The stream
+    // reset flag is filled in later if the stream needs one.
+    control_offset = offset;
+    use_palette = !colormap || color_count == 2;
+    if (!use_palette)
+    {
+        // No filter, the indices are the pixels
+        server->server_packet[offset++] = stream << 4;
+        for (int i = 0; i < 256; i++)
+        {
+            remap[i] = i;
+        }
+    }
+    else
+    {
+        server->server_packet[offset++] = (1 << 6) | (stream << 4);
+
+        // Configure the palette filter and send the palette data
+        server->server_packet[offset++] = 1;
+        server->server_packet[offset++] = color_count - 1;
+        for (int i = 0; i < 256; i++)
+        {
+            if (used[i] && colormap)
+            {
+                server->server_packet[offset++] = i;
+            }
+            else if (used[i])
+            {
+                // Note that these are not endian-adjusted like in raw encoding, Tight
+                // specifies that RGB is packed in this order
+                server->server_packet[offset++] = encoder->palette[i * 3]; // Red
+                server->server_packet[offset++] = encoder->palette[i * 3 + 1]; // Green
+                server->server_packet[offset++] = encoder->palette[i * 3 + 2]; // Blue
+            }
+        }
+    }
+
+    // Two-color palettes are packed as one bit per pixel with each row padded
+    // out to a whole byte, anything else uses one byte per pixel
+    for (int y = rect[1]; y < rect[1] + rect[3]; y++)
+    {
+        byte* row = frame + y * server->width + rect[0];
+        if (color_count == 2)
+        {
+            int bits = 0;
+            int bit_count = 0;
+            for (int x = 0; x < rect[2]; x++)
+            {
+                bits = (bits << 1) | remap[row[x]];
+                if (++bit_count == 8)
+                {
+                    indices[data_size++] = bits;
+                    bits = 0;
+                    bit_count = 0;
+                }
+            }
+
+            if (bit_count > 0)
+            {
+                indices[data_size++] = bits << (8 - bit_count);
+            }
+        }
+        else
+        {
+            for (int x = 0; x < rect[2]; x++)
+            {
+                indices[data_size++] = remap[row[x]];
+            }
+        }
+    }
+
+    // Small enough payloads skip compression entirely and are sent as-is
+    if (data_size < 12)
+    {
+        memcpy(server->server_packet + offset, indices, data_size);
+        return offset + data_size;
+    }
+
+    // Tight is also a zlib-compressed encoding. The client keeps a zlib stream
+    // going for the whole connection, so we do as well; frames tend to look a
+    // lot like the ones before them, and a rectangle can borrow from anything
+    // in the last 32K of data on the stream. The stream is only reset when
+    // clients (re)start using Tight or move between encoders.
+    if (encoder->tight_reset & (1 << stream))
+    {
+        DEFLATE_Reset(zstream);
+        server->server_packet[control_offset] |= 1 << stream;
+        encoder->tight_reset &= ~(1 << stream);
+        encoder->tight_last_size[stream] = 0;
+    }
+
+    // Anything in a band that hasn't changed since the last time the band
+    // was sent is an exact repeat of the data that's sitting right behind it
+    if (stream > 0)
+    {
+        DEFLATE_SetRepeatDistance(zstream, encoder->tight_last_size[stream]);
+    }
+
+    // The compressed data is written straight into the update, leaving room
+    // in front of it for the longest length. Whatever room the length doesn't
+    // take up is skipped over when the update is sent.
+    zlib_offset = offset + 3;
+    if (stored)
+    {
+        zlib_data_size = DEFLATE_Store(zstream, indices, data_size,
+                                       server->server_packet + zlib_offset);
+    }
+    else
+    {
+        zlib_data_size = DEFLATE_Compress(zstream, indices, data_size,
+                                          server->server_packet + zlib_offset);
+    }
+
+    encoder->tight_last_size[stream] = data_size;
+
+    offset = WriteTightLength(server, offset, zlib_data_size);
+    EndPiece(server, offset, zlib_offset);
+    return zlib_offset + zlib_data_size;
+}
+
+static int EncodeTightUpdate(vnc_server_t* server, vnc_encoder_t* encoder, byte* frame, int offset, boolean stored)
+{
+    offset = WriteFramebufferUpdateHeader(server, offset);
+
+    // We can fit any rectangle into a single Tight block since we're never
+    // transmitting anything close to its limit (2048x2048).
+    for (int r = 0; r < server->rect_count; r++)
+    {
+        int stream = server->rects_banded ? r + 1 : 0;
+        offset = WriteTightRect(server, encoder, offset, frame, server->rects + r * 4, stream, stored);
+    }
+
+    return offset;
+}
+
+void VNC_SendFrame(vnc_server_t* server, byte* frame)
+{
+    vnc_frame_t* back;
+    int previous;
+    vnc_frame_t* skipped;
+
+    if (!server->have_palette)
+    {
+        printf("VNC_SendFrame: Deferring send until palette is availble\n");
+        server->next_move_count = 0;
+        return;
+    }
+
+    back = &server->frames[server->back_frame];
+    memcpy(back->pixels, frame, server->width * server->height);
+    memcpy(back->palette, server->next_palette, 256 * 3);
+    memcpy(back->colors, server->next_colors, sizeof(back->colors));
+    memcpy(back->moves, server->next_moves, server->next_move_count * sizeof(vnc_move_t));
+    back->move_count = server->next_move_count;
+    server->next_move_count = 0;
+
+    if (server->record != NULL)
+    {
+        RecordFrame(server, back);
+    }
+
+    // This is the first frame that can show the input we're following once
+    // the tic it went into has run
+    back->probe.client = -1;
+    if (server->probe.client != -1 && server->probe.ran != -1)
+    {
+        if (server->probe.drawn == -1)
+        {
+            server->probe.drawn = GetTimeUS();
+        }
+
+        back->probe = server->probe;
+        server->probe.client = -1;
+    }
+
+    // Publish the frame. Whatever was in the ready slot before is either a
+    // frame the sender never got to, which we can reuse, or the sender's old
+    // front frame that it has already swapped out.
+    previous = atomic_exchange(&server->ready_frame, server->back_frame | VNC_FRAME_FRESH);
+    server->back_frame = previous & ~VNC_FRAME_FRESH;
+
+    // If the sender never got to the input we were following, it goes out
+    // with the next frame instead, still counting from when it was drawn
+    skipped = &server->frames[server->back_frame];
+    if ((previous & VNC_FRAME_FRESH) && skipped->probe.client != -1)
+    {
+        server->probe = skipped->probe;
+        skipped->probe.client = -1;
+    }
+
+    WakeSender(server);
+}
+
+boolean VNC_FrameWanted(vnc_server_t* server)
+{
+    return atomic_load(&server->frame_wanted) != 0;
+}
+
+void VNC_TicBuilt(vnc_server_t* server, int tic)
+{
+    if (server->probe.client != -1 && server->probe.tic == -1)
+    {
+        server->probe.tic = tic;
+    }
+}
+
+void VNC_TicRun(vnc_server_t* server, int tic)
+{
+    if (server->probe.tic != -1 && server->probe.ran == -1 && tic >= server->probe.tic)
+    {
+        server->probe.ran = GetTimeUS();
+    }
+}
+
+void VNC_MoveRect(vnc_server_t* server, int x, int y, int w, int h, int dx, int dy)
+{
+    // Only the part that's on the screen both before and after can be copied
+    int left = x > -dx ? x : -dx;
+    int top = y > -dy ? y : -dy;
+    int right = x + w < server->width - dx ? x + w : server->width - dx;
+    int bottom = y + h < server->height - dy ? y + h : server->height - dy;
+    vnc_move_t* move;
+
+    if (left < 0) left = 0;
+    if (top < 0) top = 0;
+    if (right > server->width) right = server->width;
+    if (bottom > server->height) bottom = server->height;
+
+    if (right <= left || bottom <= top || (dx == 0 && dy == 0)
+        || server->next_move_count == VNC_MAX_MOVES)
+    {
+        return;
+    }
+
+    move = &server->next_moves[server->next_move_count++];
+    move->x = left + dx;
+    move->y = top + dy;
+    move->w = right - left;
+    move->h = bottom - top;
+    move->src_x = left;
+    move->src_y = top;
+}
+
+void VNC_SendAudio(vnc_server_t* server, const int16_t* samples, int frames)
+{
+    int start;
+    int first;
+    boolean listening = false;
+
+    if (server->audio_ring == NULL)
+    {
+        return;
+    }
+
+    // Nobody could be sent more than the ring holds anyway
+    if (frames > VNC_AUDIO_RING)
+    {
+        samples += (frames - VNC_AUDIO_RING) * 2;
+        frames = VNC_AUDIO_RING;
+    }
+
+    pthread_mutex_lock(&server->lock);
+    start = server->audio_written & (VNC_AUDIO_RING - 1);
+    first = frames < VNC_AUDIO_RING - start ? frames : VNC_AUDIO_RING - start;
+    memcpy(server->audio_ring + start * 2, samples, first * 2 * sizeof(int16_t));
+    memcpy(server->audio_ring, samples + first * 2, (frames - first) * 2 * sizeof(int16_t));
+    server->audio_written += frames;
+
+    for (int i = 0; i < VNC_MAX_CLIENTS; i++)
+    {
+        if (server->clients[i].state == VNC_CLIENT_ACTIVE && server->clients[i].audio_enabled)
+        {
+            listening = true;
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    if (listening)
+    {
+        WakeSender(server);
+    }
+}
+
+
+// Finds an encoder that nobody is using and gets it ready for a new group of
+// clients, who start out needing the whole screen
+static int NewEncoder(vnc_server_t* server, vnc_encoding_t encoding, vnc_pixel_format_t pixel_format)
+{
+    for (int i = 0; i < VNC_MAX_CLIENTS; i++)
+    {
+        vnc_encoder_t* encoder = &server->encoders[i];
+        if (encoder->members > 0)
+        {
+            continue;
+        }
+
+        if (encoder->last_frame == NULL)
+        {
+            DEFLATE_Init(&encoder->tight_streams[0]);
+            encoder->tight_bands_ready = false;
+        }
+
+        OwnLastFrame(server, encoder);
+
+        encoder->encoding = encoding;
+        encoder->pixel_format = pixel_format;
+        encoder->frame_seq = -1;
+        encoder->tight_reset = VNC_TIGHT_RESET_ALL;
+        encoder->wait_start = -1;
+        memset(encoder->modes, 0, sizeof(encoder->modes));
+        encoder->mode = encoding == VNC_TIGHT ? VNC_MODE_TIGHT : VNC_MODE_RAW;
+        encoder->updates = 0;
+        encoder->update_bytes = 0;
+        return i;
+    }
+
+    // There's an encoder for every client, so one of them has to be free
+    I_Error("NewEncoder: Ran out of encoders");
+    return -1;
+}
+
+// Moves the client into an encoder of its own, which starts out knowing as
+// much about the client's screen as the one it came from did. Its zlib stream
+// has to start over, since the client's end can't pick up where the old
+// encoder's stream is going to be.
+static void DetachClient(vnc_server_t* server, vnc_client_t* client)
+{
+    vnc_encoder_t* old = &server->encoders[client->encoder];
+    int index;
+    vnc_encoder_t* encoder;
+    if (old->members == 1)
+    {
+        return;
+    }
+
+    index = NewEncoder(server, old->encoding, old->pixel_format);
+    encoder = &server->encoders[index];
+    memcpy(encoder->last_frame->pixels, old->last_frame->pixels, server->width * server->height);
+    memcpy(encoder->palette, old->palette, 256 * 3);
+    encoder->frame_seq = old->frame_seq;
+    memcpy(encoder->modes, old->modes, sizeof(old->modes));
+    encoder->updates = old->updates;
+    encoder->update_bytes = old->update_bytes;
+    encoder->members = 1;
+    old->members--;
+    client->encoder = index;
+}
+
+// Clients that have caught up with each other can share an encoder again. This
+// resets the zlib stream for everybody in the group, but that's cheaper than
+// encoding every frame twice.
+static void MergeEncoders(vnc_server_t* server)
+{
+    for (int a = 0; a < VNC_MAX_CLIENTS; a++)
+    {
+        vnc_encoder_t* target = &server->encoders[a];
+        if (target->members == 0 || target->frame_seq == -1)
+        {
+            continue;
+        }
+
+        for (int b = a + 1; b < VNC_MAX_CLIENTS; b++)
+        {
+            vnc_encoder_t* source = &server->encoders[b];
+            if (source->members == 0
+                || source->encoding != target->encoding
+                || source->pixel_format != target->pixel_format
+                || source->frame_seq != target->frame_seq)
+            {
+                continue;
+            }
+
+            for (int i = 0; i < VNC_MAX_CLIENTS; i++)
+            {
+                if (server->clients[i].encoder == b)
+                {
+                    server->clients[i].encoder = a;
+                }
+            }
+
+            target->members += source->members;
+            target->tight_reset = VNC_TIGHT_RESET_ALL;
+            source->members = 0;
+        }
+    }
+}
+
+// Lets go of the updates that the kernel has finished sending with
+// MSG_ZEROCOPY, up to and including the send numbered done. TCP finishes
+// sends in the order they were made.
+static void ReleaseZeroCopy(vnc_server_t* server, vnc_client_t* client, uint32_t done)
+{
+    int kept = 0;
+    for (int i = 0; i < client->zerocopy_count; i++)
+    {
+        if ((int32_t) (client->zerocopy_last[i] - done) <= 0)
+        {
+            ReleaseUpdate(server, client->zerocopy_held[i]);
+            continue;
+        }
+
+        client->zerocopy_held[kept] = client->zerocopy_held[i];
+        client->zerocopy_last[kept] = client->zerocopy_last[i];
+        kept++;
+    }
+
+    client->zerocopy_count = kept;
+}
+
+// Lets go of all the client's updates. The kernel may still be reading from
+// some of them, but once the client's gone it doesn't matter what it sends.
+static void ReleaseClientUpdates(vnc_server_t* server, vnc_client_t* client)
+{
+    if (client->out != NULL)
+    {
+        ReleaseUpdate(server, client->out);
+        client->out = NULL;
+    }
+
+    ReleaseZeroCopy(server, client, client->zerocopy_next - 1);
+}
+
+// Closes a client that both threads are done with. Must be called with the
+// lock held.
+static void ReapClient(vnc_server_t* server, vnc_client_t* client)
+{
+    ReleaseClientUpdates(server, client);
+
+    if (client->encoder != -1)
+    {
+        server->encoders[client->encoder].members--;
+        client->encoder = -1;
+    }
+
+    close(client->peer);
+    client->state = VNC_CLIENT_FREE;
+    printf("ReapClient: Closed client %d\n", (int) (client - server->clients));
+}
+
+// Starts writing the update to the client
+static void StartUpdate(vnc_client_t* client, vnc_update_t* update)
+{
+    client->out = update;
+    client->out_offset = 0;
+    client->out_piece = 0;
+    client->out_piece_offset = 0;
+    client->out_start = GetTimeMS();
+}
+
+// Works out how many frames of sound the client can be sent, at its own rate,
+// out of what the game has played since it was last sent any. Clients that
+// have fallen too far behind skip ahead. Must be called with the lock held.
+static int PendingAudio(vnc_server_t* server, vnc_client_t* client)
+{
+    uint32_t max_lag = (uint32_t) server->audio_rate * VNC_AUDIO_MAX_LAG / 1000;
+    uint64_t available;
+    uint64_t step;
+    uint64_t frames;
+
+    if (!client->audio_enabled)
+    {
+        return 0;
+    }
+
+    if (server->audio_written - client->audio_read > max_lag)
+    {
+        client->audio_read = server->audio_written - max_lag;
+        client->audio_frac = 0;
+    }
+
+    // Each frame we send is step frames further into our sound, and has to
+    // come from one we already have. audio_frac can be more than a whole
+    // frame when the client's rate is lower than ours.
+    available = (uint64_t) (server->audio_written - client->audio_read) << 16;
+    step = ((uint64_t) server->audio_rate << 16) / client->audio_frequency;
+    if (available <= client->audio_frac)
+    {
+        return 0;
+    }
+
+    frames = (available - client->audio_frac + step - 1) / step;
+    return frames < VNC_AUDIO_CHUNK ? frames : VNC_AUDIO_CHUNK;
+}
+
+// Writes frames of sound as a QEMU audio message in the client's format. The
+// samples are little-endian, whatever their size. Must be called with the lock
+// held.
+static int WriteAudio(vnc_server_t* server, vnc_client_t* client, int offset, int frames)
+{
+    int sample_size = 1 << (client->audio_format / 2);
+    uint32_t length = frames * client->audio_channels * sample_size;
+    uint32_t step = ((uint64_t) server->audio_rate << 16) / client->audio_frequency;
+    uint32_t position = client->audio_frac;
+    byte* out = server->server_packet + offset;
+    uint32_t advance;
+
+    out[0] = VNC_SERVER_QEMU;
+    out[1] = VNC_QEMU_AUDIO;
+    out[2] = 0;
+    out[3] = VNC_QEMU_AUDIO_DATA;
+    out[4] = (length >> 24) & 0xff;
+    out[5] = (length >> 16) & 0xff;
+    out[6] = (length >> 8) & 0xff;
+    out[7] = length & 0xff;
+    out += 8;
+
+    for (int i = 0; i < frames; i++)
+    {
+        int16_t* frame = server->audio_ring + ((client->audio_read + (position >> 16)) & (VNC_AUDIO_RING - 1)) * 2;
+        position += step;
+
+        for (int c = 0; c < client->audio_channels; c++)
+        {
+            int sample = client->audio_channels == 1 ? (frame[0] + frame[1]) / 2 : frame[c];
+            uint32_t wide = (uint32_t) (uint16_t) sample << 16;
+
+            switch (client->audio_format)
+            {
+                case VNC_AUDIO_U8:
+                    *out++ = (sample >> 8) + 128;
+                    break;
+                case VNC_AUDIO_S8:
+                    *out++ = (sample >> 8) & 0xff;
+                    break;
+                case VNC_AUDIO_U16:
+                    sample ^= 0x8000;
+                    // fallthrough
+                case VNC_AUDIO_S16:
+                    *out++ = sample & 0xff;
+                    *out++ = (sample >> 8) & 0xff;
+                    break;
+                case VNC_AUDIO_U32:
+                    wide ^= 0x80000000u;
+                    // fallthrough
+                case VNC_AUDIO_S32:
+                    *out++ = wide & 0xff;
+                    *out++ = (wide >> 8) & 0xff;
+                    *out++ = (wide >> 16) & 0xff;
+                    *out++ = (wide >> 24) & 0xff;
+                    break;
+            }
+        }
+    }
+
+    // The last frame can step past the end of what we have, in which case
+    // the rest of the step is kept for next time
+    advance = position >> 16;
+    if (advance > server->audio_written - client->audio_read)
+    {
+        advance = server->audio_written - client->audio_read;
+    }
+
+    client->audio_read += advance;
+    client->audio_frac = position - (advance << 16);
+
+    return offset + 8 + length;
+}
+
+// Turns any messages queued up for a client that isn't in the middle of an
+// update into an update of their own, followed by whatever sound the client
+// hasn't heard yet. That way the sound goes out ahead of the next frame, so
+// the two arrive in step. Must be called with the lock held.
+static void TakeControl(vnc_server_t* server, vnc_client_t* client)
+{
+    int audio_frames;
+    vnc_update_t* update;
+    int offset;
+
+    if (client->out != NULL)
+    {
+        return;
+    }
+
+    audio_frames = PendingAudio(server, client);
+    if (client->control_size == 0 && audio_frames == 0)
+    {
+        return;
+    }
+
+    update = NewUpdate(server);
+    BeginUpdate(server, update);
+    memcpy(server->server_packet, client->control, client->control_size);
+    offset = client->control_size;
+
+    if (audio_frames > 0)
+    {
+        offset = WriteAudio(server, client, offset, audio_frames);
+    }
+
+    EndPiece(server, offset, offset);
+
+    StartUpdate(client, update);
+    client->control_size = 0;
+}
+
+// Keeps the update around until the kernel is done with the zero-copy send
+// that was just made from it
+static void HoldZeroCopy(vnc_client_t* client, vnc_update_t* update)
+{
+    uint32_t send = client->zerocopy_next++;
+    int last = client->zerocopy_count - 1;
+    if (last >= 0 && client->zerocopy_held[last] == update)
+    {
+        client->zerocopy_last[last] = send;
+        return;
+    }
+
+    client->zerocopy_held[client->zerocopy_count] = update;
+    client->zerocopy_last[client->zerocopy_count] = send;
+    client->zerocopy_count++;
+    update->refs++;
+}
+
+// Whether the next write of the client's update should be zero-copy. Only
+// big updates are worth it, and only while we have room to keep track of
+// what the kernel is holding on to.
+static boolean UseZeroCopy(vnc_client_t* client)
+{
+    if (!client->zerocopy || client->out->size < VNC_ZEROCOPY_MIN)
+    {
+        return false;
+    }
+
+    return client->zerocopy_count < VNC_ZEROCOPY_HELD
+        || client->zerocopy_held[client->zerocopy_count - 1] == client->out;
+}
+
+// Reads the kernel's reports of which zero-copy sends it's finished with
+static void ReadZeroCopyDone(vnc_server_t* server, vnc_client_t* client)
+{
+#ifdef VNC_HAVE_ZEROCOPY
+    while (client->zerocopy_count > 0)
+    {
+        byte control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in))];
+        struct msghdr message = {0};
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        if (recvmsg(client->peer, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                // The socket's broken, so nothing more is coming
+                ReleaseZeroCopy(server, client, client->zerocopy_next - 1);
+            }
+
+            return;
+        }
+
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL; cmsg = CMSG_NXTHDR(&message, cmsg))
+        {
+            struct sock_extended_err* err = (struct sock_extended_err*) CMSG_DATA(cmsg);
+            if (err->ee_origin == SO_EE_ORIGIN_ZEROCOPY && err->ee_errno == 0)
+            {
+                // Each report covers a range of sends, ending with ee_data
+                ReleaseZeroCopy(server, client, err->ee_data);
+            }
+        }
+    }
+#endif
+}
+
+// Adds one sample, in microseconds, to a latency histogram
+static void AddLatency(vnc_histogram_t* histogram, int64_t us)
+{
+    int bucket = us / VNC_LATENCY_BUCKET_US;
+    if (bucket < 0)
+    {
+        bucket = 0;
+    }
+    else if (bucket >= VNC_LATENCY_BUCKETS)
+    {
+        bucket = VNC_LATENCY_BUCKETS - 1;
+    }
+
+    histogram->counts[bucket]++;
+    histogram->samples++;
+    histogram->total_us += us;
+    if (us > histogram->max_us)
+    {
+        histogram->max_us = us;
+    }
+}
+
+// Counts how long an input we've been following took to get through each
+// stage, now that the first update to show it has been written
+static void RecordLatency(vnc_server_t* server, vnc_probe_t* probe)
+{
+    int64_t times[VNC_LATENCY_TOTAL + 1] = {
+        probe->arrived,
+        probe->read,
+        probe->ran,
+        probe->drawn,
+        probe->encoding,
+        probe->encoded,
+        GetTimeUS(),
+    };
+
+    for (int s = 0; s < VNC_LATENCY_TOTAL; s++)
+    {
+        AddLatency(&server->latency[s], times[s + 1] - times[s]);
+    }
+
+    AddLatency(&server->latency[VNC_LATENCY_TOTAL], times[VNC_LATENCY_TOTAL] - times[0]);
+}
+
+// Writes as much of the client's update as its socket will take without
+// waiting, followed by anything that was queued up behind it. The rest is
+// picked up once poll says there's room for it. Returns false if the client
+// is gone.
+static boolean FlushClient(vnc_server_t* server, vnc_client_t* client)
+{
+    boolean copy = false;
+
+    while (client->out != NULL)
+    {
+        vnc_update_t* out = client->out;
+        struct iovec pieces[VNC_SEND_PIECES];
+        int count = 0;
+        int skip = client->out_piece_offset;
+        struct msghdr message = {0};
+        boolean zerocopy;
+        int chunk;
+
+        if (client->out_offset == out->size)
+        {
+            client->write_ms = Average(client->write_ms, GetTimeMS() - client->out_start, 1);
+            if (client->probe.client != -1)
+            {
+                RecordLatency(server, &client->probe);
+                client->probe.client = -1;
+            }
+
+            ReleaseUpdate(server, out);
+            client->out = NULL;
+            pthread_mutex_lock(&server->lock);
+            TakeControl(server, client);
+            pthread_mutex_unlock(&server->lock);
+            continue;
+        }
+
+        // Hand over as many of the pieces that are left as we can at once,
+        // starting partway into the first if that's where the last write
+        // stopped
+        for (int p = client->out_piece; p < out->piece_count && count < VNC_SEND_PIECES; p++)
+        {
+            pieces[count].iov_base = (byte*) out->pieces[p].iov_base + skip;
+            pieces[count].iov_len = out->pieces[p].iov_len - skip;
+            skip = 0;
+            count++;
+        }
+
+        message.msg_iov = pieces;
+        message.msg_iovlen = count;
+
+        zerocopy = !copy && UseZeroCopy(client);
+        chunk = sendmsg(client->peer, &message,
+                        MSG_DONTWAIT | MSG_NOSIGNAL | (zerocopy ? VNC_SEND_ZEROCOPY : 0));
+
+        if (chunk < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return true;
+        }
+
+        if (chunk < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        // The kernel can only track so many zero-copy sends at once. The
+        // rest of this flush is copied instead.
+        if (chunk < 0 && errno == ENOBUFS && zerocopy)
+        {
+            copy = true;
+            continue;
+        }
+
+        if (chunk <= 0)
+        {
+            // Client disconnected or something else unusual happened. The game
+            // thread notices this the next time it pumps messages.
+            printf("FlushClient: framebuffer send failure (%s)\n", chunk < 0 ? strerror(errno) : "closed");
+            pthread_mutex_lock(&server->lock);
+            client->dead = true;
+            pthread_mutex_unlock(&server->lock);
+            ReleaseUpdate(server, out);
+            client->out = NULL;
+            return false;
+        }
+
+        if (zerocopy)
+        {
+            HoldZeroCopy(client, out);
+        }
+
+        client->out_offset += chunk;
+        client->written += chunk;
+
+        while (chunk > 0)
+        {
+            int left = out->pieces[client->out_piece].iov_len - client->out_piece_offset;
+            if (chunk < left)
+            {
+                client->out_piece_offset += chunk;
+                break;
+            }
+
+            chunk -= left;
+            client->out_piece++;
+            client->out_piece_offset = 0;
+        }
+    }
+
+    return true;
+}
+
+// How many bytes we've written to the socket that the other end hasn't
+// acknowledged yet, where the platform can tell us
+static int GetSendBacklog(int sock)
+{
+    int backlog = 0;
+#ifdef SIOCOUTQ
+    if (ioctl(sock, SIOCOUTQ, &backlog) != 0)
+    {
+        backlog = 0;
+    }
+#endif
+    return backlog;
+}
+
+// Checks how much the client's send queue has drained since we last looked.
+// That only tells us how fast the connection is if the queue never ran dry
+// in between, which we take to be the case if it wasn't empty either time.
+// While it keeps up with everything we give it we don't learn anything, so a
+// slow estimate is let drift back up in case the connection has recovered.
+static void SampleClientRate(vnc_client_t* client, int now)
+{
+    int elapsed;
+    uint32_t delivered;
+
+    client->backlog = GetSendBacklog(client->peer);
+
+    elapsed = now - client->sample_time;
+    if (elapsed < VNC_RATE_SAMPLE)
+    {
+        return;
+    }
+
+    delivered = client->written - client->backlog;
+    if (client->sample_busy && client->backlog > 0)
+    {
+        double rate = (double) (delivered - client->sample_delivered) / elapsed;
+        client->rate = Average(client->rate, rate, 1);
+        if (client->rate < VNC_MIN_RATE)
+        {
+            client->rate = VNC_MIN_RATE;
+        }
+    }
+    else if (client->backlog == 0 && client->rate < VNC_DEFAULT_RATE)
+    {
+        client->rate += (VNC_DEFAULT_RATE - client->rate) / 16;
+    }
+
+    client->sample_time = now;
+    client->sample_delivered = delivered;
+    client->sample_busy = client->backlog > 0;
+}
+
+static const char* vnc_mode_names[VNC_MODE_COUNT] = {
+    "raw",
+    "tight-stored",
+    "tight",
+};
+
+static const char* vnc_latency_names[VNC_LATENCY_COUNT] = {
+    "queue",
+    "tic",
+    "render",
+    "wait",
+    "encode",
+    "send",
+    "total",
+};
+
+// The latency, in milliseconds, that the given percentage of samples came in
+// under, as near as the buckets can tell
+static double LatencyPercentile(vnc_histogram_t* histogram, int percent)
+{
+    int wanted = (histogram->samples * percent + 99) / 100;
+    int seen = 0;
+    int64_t us = histogram->max_us;
+
+    for (int b = 0; b < VNC_LATENCY_BUCKETS - 1; b++)
+    {
+        seen += histogram->counts[b];
+        if (seen >= wanted)
+        {
+            us = (int64_t) (b + 1) * VNC_LATENCY_BUCKET_US;
+            break;
+        }
+    }
+
+    if (us > histogram->max_us)
+    {
+        us = histogram->max_us;
+    }
+
+    return us / 1000.0;
+}
+
+static void PrintStats(vnc_server_t* server)
+{
+    printf("PrintStats: %d frames\n", server->frame_seq);
+
+    pthread_mutex_lock(&server->lock);
+    for (int i = 0; i < VNC_MAX_CLIENTS; i++)
+    {
+        vnc_client_t* client = &server->clients[i];
+        if (client->state != VNC_CLIENT_ACTIVE || client->dead)
+        {
+            continue;
+        }
+
+        printf("PrintStats: client %d: encoder %d, %.0f KB/s, %d bytes queued, "
+               "%.1f ms per write, %u bytes sent, %d frames dropped\n",
+               i, client->encoder, client->rate * 1000 / 1024, client->backlog,
+               client->write_ms, client->written, client->dropped);
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    for (int e = 0; e < VNC_MAX_CLIENTS; e++)
+    {
+        vnc_encoder_t* encoder = &server->encoders[e];
+        if (encoder->members == 0)
+        {
+            continue;
+        }
+
+        printf("PrintStats: encoder %d: %d clients, %d updates averaging %.0f bytes, "
+               "last sent as %s\n",
+               e, encoder->members, encoder->updates, encoder->update_bytes,
+               vnc_mode_names[encoder->mode]);
+
+        for (int m = 0; m < VNC_MODE_COUNT; m++)
+        {
+            vnc_mode_stats_t* stats = &encoder->modes[m];
+            if (stats->uses > 0)
+            {
+                printf("PrintStats:   %s: %d uses, %.4f us and %.3f bytes per pixel\n",
+                       vnc_mode_names[m], stats->uses, stats->encode_us, stats->bytes);
+            }
+        }
+    }
+
+    // Unlike the rest, latency is counted afresh for each interval, so that
+    // it shows how things are going now
+    for (int s = 0; s < VNC_LATENCY_COUNT; s++)
+    {
+        vnc_histogram_t* histogram = &server->latency[s];
+        if (histogram->samples > 0)
+        {
+            printf("PrintStats: latency %s: %d inputs, %.1f ms average, "
+                   "%.1f/%.1f/%.1f ms at 50/90/99%%, %.1f ms max\n",
+                   vnc_latency_names[s], histogram->samples,
+                   histogram->total_us / 1000.0 / histogram->samples,
+                   LatencyPercentile(histogram, 50), LatencyPercentile(histogram, 90),
+                   LatencyPercentile(histogram, 99), histogram->max_us / 1000.0);
+        }
+    }
+
+    memset(server->latency, 0, sizeof(server->latency));
+}
+
+// How many pixels the dirty rectangles cover
+static int DirtyPixels(vnc_server_t* server)
+{
+    int pixels = 0;
+    for (int r = 0; r < server->rect_count; r++)
+    {
+        pixels += server->rects[r * 4 + 2] * server->rects[r * 4 + 3];
+    }
+
+    return pixels;
+}
+
+// Picks the mode we expect to get an update of the given number of changed
+// pixels onto the screens of the encoder's clients soonest, which is the time
+// it takes to encode plus the time it takes to get through the slowest of
+// their connections. Modes that haven't been used in a while are tried again
+// first, since we can only know how they're doing by using them.
+static vnc_mode_t PickMode(vnc_encoder_t* encoder, int pixels, double rate)
+{
+    vnc_mode_t best = VNC_MODE_RAW;
+    double best_ms = -1;
+
+    if (encoder->encoding != VNC_TIGHT)
+    {
+        return VNC_MODE_RAW;
+    }
+
+    for (int m = VNC_MODE_COUNT - 1; m >= 0; m--)
+    {
+        vnc_mode_stats_t* stats = &encoder->modes[m];
+        if (stats->uses == 0 || encoder->updates - stats->last_used > VNC_MODE_PROBE)
+        {
+            return m;
+        }
+    }
+
+    for (int m = 0; m < VNC_MODE_COUNT; m++)
+    {
+        vnc_mode_stats_t* stats = &encoder->modes[m];
+        double ms = pixels * (stats->encode_us / 1000 + stats->bytes / rate);
+        if (best_ms < 0 || ms < best_ms)
+        {
+            best = m;
+            best_ms = ms;
+        }
+    }
+
+    return best;
+}
+
+// Works out what the encoder's clients need to get from the frame they have
+// to this one: a new color map if they keep one and the palette changed, the
+// moves that can be sent as copies, and the dirty rectangles that are left.
+// Returns false if there's nothing they'd notice.
+static boolean FindChanges(vnc_server_t* server, vnc_encoder_t* encoder, vnc_frame_t* frame, boolean can_copy, boolean* send_colormap)
+{
+    // A new palette changes the color of every pixel true color clients
+    // have. Color map clients only need the new color map.
+    boolean colormap = encoder->pixel_format == VNC_COLORMAP;
+    boolean palette_changed = encoder->frame_seq == -1
+        || memcmp(encoder->palette, frame->palette, 256 * 3) != 0;
+    boolean full_refresh = encoder->frame_seq == -1 || (palette_changed && !colormap);
+
+    // The game's moves can only be sent as copies if every client in the
+    // group understands them
+    byte* base = NULL;
+    server->copy_count = 0;
+    if (!full_refresh)
+    {
+        base = encoder->last_frame->pixels;
+        if (can_copy && frame->move_count > 0)
+        {
+            base = ApplyMoves(server, encoder, frame);
+        }
+    }
+
+    FindDirtyRects(server, encoder, frame->pixels, base, full_refresh);
+
+    *send_colormap = colormap && palette_changed;
+    return server->rect_count > 0 || server->copy_count > 0 || *send_colormap;
+}
+
+// Brings the encoder up to date with the frame, and returns the update that
+// gets its clients there, encoded in the given mode. The changes have to have
+// been found already.
+static vnc_update_t* EncodeUpdate(vnc_server_t* server, vnc_encoder_t* encoder, vnc_frame_t* frame, boolean send_colormap, vnc_mode_t mode)
+{
+    vnc_update_t* update;
+    int size = 0;
+
+    OwnLastFrame(server, encoder);
+    memcpy(encoder->palette, frame->palette, 256 * 3);
+    memcpy(encoder->colors, frame->colors, sizeof(encoder->colors));
+    memcpy(encoder->last_frame->pixels, frame->pixels, server->width * server->height);
+    encoder->frame_seq = server->frame_seq;
+
+    update = NewUpdate(server);
+    BeginUpdate(server, update);
+
+    // The new color map has to get there before any pixels drawn with it
+    if (send_colormap)
+    {
+        size = WriteColorMapEntries(server, encoder, size);
+    }
+
+    if (server->rect_count > 0)
+    {
+        int pixels = DirtyPixels(server);
+        int64_t start = GetTimeUS();
+        int start_size;
+        vnc_mode_stats_t* stats;
+
+        EndPiece(server, size, size);
+        start_size = update->size;
+
+        switch (mode)
+        {
+            case VNC_MODE_RAW:
+                size = EncodeRawUpdate(server, encoder, frame->pixels, size);
+                break;
+            case VNC_MODE_TIGHT_STORED:
+                size = EncodeTightUpdate(server, encoder, frame->pixels, size, true);
+                break;
+            case VNC_MODE_TIGHT:
+                size = EncodeTightUpdate(server, encoder, frame->pixels, size, false);
+                break;
+            default:
+                break;
+        }
+
+        EndPiece(server, size, size);
+        stats = &encoder->modes[mode];
+        stats->encode_us = Average(stats->encode_us, (double) (GetTimeUS() - start) / pixels, stats->uses);
+        stats->bytes = Average(stats->bytes, (double) (update->size - start_size) / pixels, stats->uses);
+        stats->uses++;
+        stats->last_used = encoder->updates;
+        encoder->mode = mode;
+    }
+    else if (server->copy_count > 0)
+    {
+        size = WriteFramebufferUpdateHeader(server, size);
+    }
+
+    EndPiece(server, size, size);
+    encoder->update_bytes = Average(encoder->update_bytes, update->size, encoder->updates);
+    encoder->updates++;
+    return update;
+}
+
+// Works out whether any client that isn't backed up is ready for a frame it
+// hasn't been sent, and lets the game know
+static void UpdateFrameWanted(vnc_server_t* server, boolean* live, boolean* backed_up)
+{
+    boolean frame_wanted = false;
+
+    pthread_mutex_lock(&server->lock);
+    for (int i = 0; i < VNC_MAX_CLIENTS; i++)
+    {
+        vnc_client_t* client = &server->clients[i];
+        if (!live[i] || backed_up[i] || client->out != NULL)
+        {
+            continue;
+        }
+
+        if (client->send_frame
+            || (client->continuous && client->bytes_sent - client->bytes_acked < (uint32_t) client->window))
+        {
+            frame_wanted = true;
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    atomic_store(&server->frame_wanted, frame_wanted);
+}
+
+// Sends the latest frame to every client that's waiting for one. Returns how
+// long the sender can sleep before it has to check back on clients that are
+// being waited for, or -1 if it can sleep until it's woken up.
+static int SendPendingUpdates(vnc_server_t* server)
+{
+    boolean live[VNC_MAX_CLIENTS];
+    boolean requested[VNC_MAX_CLIENTS];
+    boolean wanted[VNC_MAX_CLIENTS];
+    boolean backed_up[VNC_MAX_CLIENTS];
+    boolean continuous[VNC_MAX_CLIENTS];
+    boolean copyrect[VNC_MAX_CLIENTS];
+    vnc_frame_t* frame;
+    int now;
+    int timeout = -1;
+
+    // Pick up whatever the clients have asked for since we last looked. Clients
+    // that need something different from the rest of their group get an
+    // encoder of their own until they've caught up.
+    pthread_mutex_lock(&server->lock);
+    for (int i = 0; i < VNC_MAX_CLIENTS; i++)
+    {
+        vnc_client_t* client = &server->clients[i];
+        live[i] = false;
+        requested[i] = false;
+        wanted[i] = false;
+        backed_up[i] = false;
+        continuous[i] = false;
+        copyrect[i] = false;
+
+        if (client->state != VNC_CLIENT_ACTIVE)
+        {
+            continue;
+        }
+
+        if (client->dead)
+        {
+            if (client->released)
+            {
+                ReapClient(server, client);
+            }
+
+            continue;
+        }
+
+        if (client->encoder == -1)
+        {
+            client->encoder = NewEncoder(server, client->encoding, client->pixel_format);
+            server->encoders[client->encoder].members = 1;
+            client->encoding_changed = false;
+            client->pixel_format_changed = false;
+            client->full_refresh = false;
+        }
+
+        // Whatever the client had on screen is meaningless in a new pixel
+        // format, and it doesn't have a color map yet either
+        if (client->pixel_format_changed)
+        {
+            DetachClient(server, client);
+            server->encoders[client->encoder].pixel_format = client->pixel_format;
+            server->encoders[client->encoder].frame_seq = -1;
+            server->encoders[client->encoder].tight_reset = VNC_TIGHT_RESET_ALL;
+            client->pixel_format_changed = false;
+        }
+
+        if (client->encoding_changed)
+        {
+            DetachClient(server, client);
+            server->encoders[client->encoder].encoding = client->encoding;
+            server->encoders[client->encoder].tight_reset = VNC_TIGHT_RESET_ALL;
+            client->encoding_changed = false;
+        }
+
+        if (client->full_refresh)
+        {
+            DetachClient(server, client);
+            server->encoders[client->encoder].frame_seq = -1;
+            client->full_refresh = false;
+        }
+
+        // Clients with continuous updates on get every frame without asking,
+        // as long as they've kept up with the ones they already have
+        continuous[i] = client->continuous;
+        copyrect[i] = client->copyrect_supported;
+        requested[i] = client->send_frame
+            || (client->continuous && client->bytes_sent - client->bytes_acked < (uint32_t) client->window);
+
+        live[i] = true;
+        TakeControl(server, client);
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    // Queued messages go out ahead of anything else, and clients that can take
+    // them right away are still ready for an update this time around
+    for (int i = 0; i < VNC_MAX_CLIENTS; i++)
+    {
+        vnc_client_t* client = &server->clients[i];
+        if (live[i] && client->out != NULL)
+        {
+            live[i] = FlushClient(server, client);
+        }
+
+        wanted[i] = live[i] && requested[i] && client->out == NULL;
+    }
+
+    if (atomic_load(&server->ready_frame) & VNC_FRAME_FRESH)
+    {
+        int ready = atomic_exchange(&server->ready_frame, server->front_frame);
+        vnc_probe_t* probe;
+
+        server->front_frame = ready & ~VNC_FRAME_FRESH;
+        server->have_frame = true;
+        server->frame_seq++;
+
+        // Take over following the input the frame shows, unless we're still
+        // waiting to send the one before it to a client that's still here
+        probe = &server->frames[server->front_frame].probe;
+        if (probe->client != -1
+            && (server->frame_probe.client == -1 || !live[server->frame_probe.client]))
+        {
+            server->frame_probe = *probe;
+        }
+    }
 
-    struct sockaddr_in peer_addr = {0};
-    socklen_t peer_addrlen = {0};
+    if (!server->have_frame)
+    {
+        UpdateFrameWanted(server, live, backed_up);
+        return -1;
+    }
 
-    bind(server_sock, (const struct sockaddr*) &listen_addr, sizeof(struct sockaddr_in));
-    listen(server_sock, 1);
-    server->peer = -1;
+    frame = &server->frames[server->front_frame];
+    now = GetTimeMS();
 
-    // Accept as many clients as we have to before one gives us the details we like
-    while (1)
+    // A frame sent to a client whose connection is already backed up would
+    // only arrive that much later, so those skip frames until it clears
+    for (int i = 0; i < VNC_MAX_CLIENTS; i++)
     {
-        printf("VNC_Init: Waiting for connection\n");
-        server->peer = accept(server_sock, (struct sockaddr*) &peer_addr, &peer_addrlen);
-        if (server->peer == -1)
+        vnc_client_t* client = &server->clients[i];
+        int backlog_ms;
+        if (!live[i])
         {
-            printf("VNC_Init: Failed to acquire client (%s)\n", strerror(errno));
             continue;
         }
 
-        // Perform the VNC handshake. This is fairly simple, we just have to send over our version string,
-        // auth info and initial state. A few things to watch out for:
-        //
-        // - The client sends a version lower than 3.8 (these have a different handshake mechanism, according
-        //   to the RFC, which we don't want to support)
-        //
-        // - The client refuses to support non-authenticated connections.
-        byte client_init_buffer[12];
-        if (SendAll(server->peer, "RFB 003.008\n", 12))
+        SampleClientRate(client, now);
+
+        backlog_ms = client->backlog / client->rate;
+        backed_up[i] = backlog_ms > VNC_BACKLOG_LIMIT;
+        if (wanted[i] && backed_up[i])
         {
-            printf("VNC_Init: Dropped client (could not send verstr)\n");
-            goto client_abort;
+            int wait_left;
+
+            wanted[i] = false;
+            if (server->encoders[client->encoder].frame_seq != server->frame_seq
+                && client->dropped_seq != server->frame_seq)
+            {
+                client->dropped++;
+                client->dropped_seq = server->frame_seq;
+            }
+
+            // Check back before long in case we've underestimated how fast
+            // the connection is
+            wait_left = backlog_ms - VNC_BACKLOG_LIMIT;
+            if (wait_left > VNC_BACKLOG_LIMIT)
+            {
+                wait_left = VNC_BACKLOG_LIMIT;
+            }
+
+            if (timeout == -1 || wait_left < timeout)
+            {
+                timeout = wait_left;
+            }
         }
+    }
 
-        if (RecvAll(server->peer, client_init_buffer, 12))
+    for (int e = 0; e < VNC_MAX_CLIENTS; e++)
+    {
+        vnc_encoder_t* encoder = &server->encoders[e];
+        int ready_count = 0;
+        int waiting_count = 0;
+        boolean can_copy = true;
+        double rate = VNC_DEFAULT_RATE;
+        boolean send_colormap;
+        int64_t encode_start;
+        vnc_mode_t mode;
+        vnc_update_t* update;
+        boolean answered;
+        if (encoder->members == 0 || encoder->frame_seq == server->frame_seq)
         {
-            printf("VNC_Init: Dropped client (could not recv verstr)\n");
-            goto client_abort;
+            continue;
         }
 
-        if (strncmp("RFB 003.008\n", client_init_buffer, 12) != 0)
+        for (int i = 0; i < VNC_MAX_CLIENTS; i++)
         {
-            // Try to let the client know what's going on, if possible, before we kick them off
-            // (0 security types; 13-byte reason string)
-            SendAll(server->peer, "\x00\x00\x00\x00\x13Unsupported version", 18);
-            printf("VNC_Init: Dropped client (invalid verstr: '%12.s')\n", client_init_buffer);
-            goto client_abort;
+            if (live[i] && server->clients[i].encoder == e)
+            {
+                can_copy = can_copy && copyrect[i];
+
+                if (wanted[i])
+                {
+                    ready_count++;
+                    if (ready_count == 1 || server->clients[i].rate < rate)
+                    {
+                        rate = server->clients[i].rate;
+                    }
+                }
+                else
+                {
+                    waiting_count++;
+                }
+            }
         }
 
-        printf("VNC_Init: Got good client version (%.11s)\n", client_init_buffer);
-        // (1 security type; None)
-        if (SendAll(server->peer, "\x01\x01", 2))
+        // Incremental requests don't have to be answered until something
+        // changes, so until somebody asks there's nothing to do
+        if (ready_count == 0)
         {
-            printf("VNC_Init: Dropped client (could not send auth types)\n");
-            goto client_abort;
+            continue;
         }
 
-        if (RecvAll(server->peer, client_init_buffer, 1))
+        if (!FindChanges(server, encoder, frame, can_copy, &send_colormap))
         {
-            printf("VNC_Init: Dropped client (did not receive auth type)\n");
-            goto client_abort;
+            // Nothing the clients can see has changed, so they already have
+            // this frame as far as we're concerned. Whatever input we were
+            // following for one of them didn't show.
+            encoder->frame_seq = server->frame_seq;
+            encoder->wait_start = -1;
+            if (server->frame_probe.client != -1
+                && server->clients[server->frame_probe.client].encoder == e)
+            {
+                server->frame_probe.client = -1;
+            }
+            continue;
         }
 
-        if (client_init_buffer[0] != 1)
+        // Clients on a fast connection usually ask for the next update right
+        // after they get the last one, so give the rest of the group a moment
+        // to catch up before leaving them behind
+        if (waiting_count > 0)
         {
-            // The client chose an illegal auth type, somehow
-            // (status failed; 17-byte reason string)
-            SendAll(server->peer, "\x00\x00\x00\x01\x00\x00\x00\x11Illegal auth type", 25);
-            printf("VNC_Init: Dropped client (illegal auth type: %d)\n", client_init_buffer[0]);
-            goto client_abort;
-        }
+            int wait_left;
 
-        printf("VNC_Init: Got good auth\n");
+            if (encoder->wait_start == -1)
+            {
+                encoder->wait_start = now;
+            }
 
-        // (status successful)
-        if (SendAll(server->peer, "\x00\x00\x00\x00", 4))
-        {
-            printf("VNC_Init: Dropped client (could not send auth success)\n");
-            goto client_abort;
+            wait_left = encoder->wait_start + VNC_COHORT_WAIT - now;
+            if (wait_left > 0)
+            {
+                if (timeout == -1 || wait_left < timeout)
+                {
+                    timeout = wait_left;
+                }
+
+                continue;
+            }
+
+            for (int i = 0; i < VNC_MAX_CLIENTS; i++)
+            {
+                if (live[i] && server->clients[i].encoder == e && !wanted[i])
+                {
+                    DetachClient(server, &server->clients[i]);
+                }
+            }
         }
 
-        // The shared flag doesn't really matter since we support only one
-        // client anyway, just read it and stuff the value into some storage
-        // we already have on hand
-        if (RecvAll(server->peer, client_init_buffer, 1))
+        encoder->wait_start = -1;
+
+        encode_start = GetTimeUS();
+        mode = PickMode(encoder, DirtyPixels(server), rate);
+        update = EncodeUpdate(server, encoder, frame, send_colormap, mode);
+        answered = server->rect_count > 0 || server->copy_count > 0;
+        for (int i = 0; i < VNC_MAX_CLIENTS; i++)
         {
-            printf("VNC_Init: Dropped client (could not recv client init)\n");
-            goto client_abort;
-        }
+            vnc_client_t* client = &server->clients[i];
+            uint32_t bytes_sent;
+            if (!wanted[i] || client->encoder != e)
+            {
+                continue;
+            }
+
+            StartUpdate(client, update);
+            update->refs++;
+
+            if (answered && server->frame_probe.client == i)
+            {
+                client->probe = server->frame_probe;
+                client->probe.encoding = encode_start;
+                client->probe.encoded = GetTimeUS();
+                server->frame_probe.client = -1;
+            }
+
+            // A color map on its own isn't a framebuffer update, so the
+            // client is still waiting on one of those
+            pthread_mutex_lock(&server->lock);
+            if (answered)
+            {
+                client->send_frame = false;
+            }
+
+            if (continuous[i])
+            {
+                client->bytes_sent += update->size;
+            }
 
-        printf("VNC_Init: Got client init\n");
+            bytes_sent = client->bytes_sent;
+            pthread_mutex_unlock(&server->lock);
 
-        byte server_init[28];
-        server_init[0] = (server->width >> 8) & 0xff; // Framebuffer width
-        server_init[1] = server->width & 0xff;
-        server_init[2] = (server->height >> 8) & 0xff; // Framebuffer height
-        server_init[3] = server->height & 0xff;
-        server_init[4] = 32; // Bits per pixel
-        server_init[5] = 24; // Depth
-        server_init[6] = 0; // Big-endian flag
-        server_init[7] = 1; // True color flag
-        server_init[8] = 0; // Red scale
-        server_init[9] = 255;
-        server_init[10] = 0; // Green scale
-        server_init[11] = 255;
-        server_init[12] = 0; // Blue scale
-        server_init[13] = 255;
-        server_init[14] = 16; // Red shift
-        server_init[15] = 8; // Green shift
-        server_init[16] = 0; // Blue shift
-        server_init[20] = 0; // Desktop name length
-        server_init[21] = 0;
-        server_init[22] = 0;
-        server_init[23] = 4;
-        server_init[24] = 'D'; // Desktop name
-        server_init[25] = 'O';
-        server_init[26] = 'O';
-        server_init[27] = 'M';
+            // Follow up continuous updates with a fence, so that we find out
+            // when they've arrived
+            if (continuous[i])
+            {
+                uint32_t sent_time = GetTimeMS();
+                byte payload[8];
+                payload[0] = (sent_time >> 24) & 0xff;
+                payload[1] = (sent_time >> 16) & 0xff;
+                payload[2] = (sent_time >> 8) & 0xff;
+                payload[3] = sent_time & 0xff;
+                payload[4] = (bytes_sent >> 24) & 0xff;
+                payload[5] = (bytes_sent >> 16) & 0xff;
+                payload[6] = (bytes_sent >> 8) & 0xff;
+                payload[7] = bytes_sent & 0xff;
+                QueueFence(server, client, VNC_FENCE_REQUEST, payload, 8);
+            }
+        }
 
-        // At this point we've completed the handshake and have a working
-        // connection with the client. It may send some more initial
-        // configuration later but for the time being we can let the game continue.
-        if (SendAll(server->peer, server_init, 28))
+        // Only start writing once everybody has a reference, otherwise the
+        // first client to finish would free the update out from under the rest
+        for (int i = 0; i < VNC_MAX_CLIENTS; i++)
         {
-            printf("VNC_Init: Dropped client (could not send server init)\n");
-            goto client_abort;
+            if (server->clients[i].out == update)
+            {
+                FlushClient(server, &server->clients[i]);
+            }
         }
+    }
 
-        // We can't accept any clients beyond the first, so don't bother listening
-        close(server_sock);
-        printf("VNC_Init: All done here, starting up with default raw encoding\n");
-        break;
+    MergeEncoders(server);
+    UpdateFrameWanted(server, live, backed_up);
 
-client_abort:
-        close(server->peer);
-        server->peer = -1;
-        continue;
+    if (server->show_stats && now - server->stats_time >= VNC_STATS_INTERVAL)
+    {
+        PrintStats(server);
+        server->stats_time = now;
     }
-}
 
-void VNC_SetTextInput(vnc_server_t* server, boolean state)
-{
-    server->text_input = state;
+    return timeout;
 }
 
-void VNC_PumpMessages(vnc_server_t* server)
+static void* SenderThread(void* arg)
 {
-    fd_set readers = {0};
-
-    // Return immediately, only pull the data that's buffered
-    int events = 0;
-
-    // Collapse several cursor movement packets into a single event
-    int new_mouse_x = -1;
-    int new_mouse_y = -1;
-    int mouse_buttons = -1;
-    do {
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 0;
+    vnc_server_t* server = arg;
+    struct pollfd fds[VNC_MAX_CLIENTS + 1];
+    vnc_client_t* polled[VNC_MAX_CLIENTS + 1];
+    byte drain[64];
+    int timeout = -1;
 
-        FD_ZERO(&readers);
-        FD_SET(server->peer, &readers);
+    while (!atomic_load(&server->shutting_down))
+    {
+        // Besides being woken up, we also need to know when clients that
+        // couldn't take all of their last update have room for the rest, and
+        // when the kernel is done with zero-copy sends. Those are reported as
+        // errors, which poll always looks for.
+        int count = 1;
+        fds[0].fd = server->wake_pipe[0];
+        fds[0].events = POLLIN;
 
-        events = select(server->peer + 1, &readers, NULL, NULL, &timeout);
-        if (events == -1)
+        for (int i = 0; i < VNC_MAX_CLIENTS; i++)
         {
-            printf("VNC_PumpMessages: Could not poll (%s)\n", strerror(errno));
-            return;
+            vnc_client_t* client = &server->clients[i];
+            if (client->out != NULL || client->zerocopy_count > 0)
+            {
+                fds[count].fd = client->peer;
+                fds[count].events = client->out != NULL ? POLLOUT : 0;
+                polled[count] = client;
+                count++;
+            }
         }
 
-        if (events == 1)
+        if (poll(fds, count, timeout) < 0 && errno != EINTR)
         {
-            int chunk = recv(server->peer, server->client_packet + server->packet_cursor, VNC_PACKET_SIZE - server->packet_cursor, 0);
-            if (chunk <= 0)
-            {
-                // If the client is dead here, then we have to abort. Otherwise
-                // we could end up waiting here for a while which could throw
-                // off the game's timing once somebody reconnects.
-                printf("VNC_PumpMessages: socket read failure\n");
-                VNC_Exit(server);
-                I_Quit();
-                break;
-            }
+            printf("SenderThread: Could not poll (%s)\n", strerror(errno));
+            atomic_store(&server->sender_failed, 1);
+            break;
+        }
 
-            server->packet_cursor += chunk;
+        while (read(server->wake_pipe[0], drain, sizeof(drain)) > 0);
 
-            int old_scan_pos = 0;
-            int message_scan_pos = 0;
-            while (message_scan_pos >= 0)
-            {
-              old_scan_pos = message_scan_pos;
-              message_scan_pos = HandleVNCMessage(server, message_scan_pos, &new_mouse_x, &new_mouse_y, &mouse_buttons);
-            }
+        if (atomic_load(&server->shutting_down))
+        {
+            break;
+        }
 
-            if (message_scan_pos == -2)
+        for (int i = 1; i < count; i++)
+        {
+            if (fds[i].revents & POLLERR)
             {
-                printf("VNC_PumpMessages: Flushing buffer after unknown message\n");
+                ReadZeroCopyDone(server, polled[i]);
             }
-            else
+
+            if (fds[i].revents != 0 && polled[i]->out != NULL)
             {
-                FinalizeVNCMessages(server, old_scan_pos);
+                FlushClient(server, polled[i]);
             }
         }
-    } while (events == 1);
-
-    if (new_mouse_x != -1)
-    {
-        event_t event;
-        event.type = ev_mouse;
-        event.data1 = mouse_buttons;
-        event.data2 = new_mouse_x - server->mouse_x;
-        event.data3 = new_mouse_y - server->mouse_y;
-        D_PostEvent(&event);
 
-        server->mouse_x = new_mouse_x;
-        server->mouse_y = new_mouse_y;
+        timeout = SendPendingUpdates(server);
     }
+
+    return NULL;
 }
 
-void VNC_PreparePalette(vnc_server_t* server, rgb_t* palette)
+void VNC_Exit(vnc_server_t* server)
 {
-    if (server->palette == NULL)
+    if (server->sender_running)
     {
-        server->palette = malloc(server->width * server->height * 3);
+        atomic_store(&server->shutting_down, 1);
+        WakeSender(server);
+        pthread_join(server->sender, NULL);
+        server->sender_running = false;
+
+        if (server->show_stats)
+        {
+            PrintStats(server);
+        }
+
+        close(server->wake_pipe[0]);
+        close(server->wake_pipe[1]);
+        pthread_mutex_destroy(&server->lock);
     }
 
-    // The palette is usually function scoped and loaded from a cached lump, so
-    // it's not guaranteed to be around later on. Make sure we copy it.
-    int offset = 0;
-    for (int i = 0; i < 256; i++)
+    if (server->dirty_tiles == NULL)
     {
-        server->palette[offset++] = palette[i].r;
-        server->palette[offset++] = palette[i].g;
-        server->palette[offset++] = palette[i].b;
+        return;
     }
-}
 
-static void SendRawVNCFrame(vnc_server_t* server, byte* frame)
-{
-    int offset = 0;
-    server->server_packet[offset++] = VNC_SERVER_FRAMEBUFFERUPDATE;
-    offset++; // Padding
-    server->server_packet[offset++] = 0; // Number of rectangles worth of pixel data, we only ever send the whole screen
-    server->server_packet[offset++] = 1;
-    server->server_packet[offset++] = 0; // X coordinate
-    server->server_packet[offset++] = 0;
-    server->server_packet[offset++] = 0; // Y coordinate
-    server->server_packet[offset++] = 0;
-    server->server_packet[offset++] = (server->width >> 8); // Width
-    server->server_packet[offset++] = server->width & 0xff;
-    server->server_packet[offset++] = (server->height >> 8); // Height
-    server->server_packet[offset++] = server->height & 0xff;
-    server->server_packet[offset++] = 0; // Raw encoding type
-    server->server_packet[offset++] = 0;
-    server->server_packet[offset++] = 0;
-    server->server_packet[offset++] = VNC_RAW;
-    if (SendAll(server->peer, server->server_packet, offset))
+    for (int i = 0; i < VNC_MAX_CLIENTS; i++)
     {
-        VNC_Exit(server);
-        I_Quit();
-        return;
+        vnc_client_t* client = &server->clients[i];
+        if (client->state != VNC_CLIENT_FREE)
+        {
+            ReleaseClientUpdates(server, client);
+            close(client->peer);
+            client->state = VNC_CLIENT_FREE;
+        }
+
+        if (server->encoders[i].last_frame != NULL)
+        {
+            ReleasePixels(server->encoders[i].last_frame);
+            DEFLATE_Free(&server->encoders[i].tight_streams[0]);
+            for (int j = 1; j < VNC_TIGHT_STREAMS && server->encoders[i].tight_bands_ready; j++)
+            {
+                DEFLATE_Free(&server->encoders[i].tight_streams[j]);
+            }
+            server->encoders[i].last_frame = NULL;
+        }
     }
 
-    offset = 0;
-    for (int i = 0; i < server->width * server->height; i++)
+    close(server->listener);
+
+    while (server->spare_count > 0)
     {
-        server->server_packet[offset++] = server->palette[frame[i] * 3 + 2];
-        server->server_packet[offset++] = server->palette[frame[i] * 3 + 1];
-        server->server_packet[offset++] = server->palette[frame[i] * 3];
-        server->server_packet[offset++] = 0;
+        vnc_update_t* update = server->spare_updates[--server->spare_count];
+        free(update->data);
+        free(update->pieces);
+        free(update);
     }
 
-    if (SendAll(server->peer, server->server_packet, offset))
+    free(server->dirty_tiles);
+    free(server->rects);
+    free(server->tight_indices);
+    free(server->moved_frame);
+    free(server->audio_ring);
+    server->building = NULL;
+    server->server_packet = NULL;
+    server->dirty_tiles = NULL;
+    server->rects = NULL;
+    server->tight_indices = NULL;
+    server->moved_frame = NULL;
+    server->audio_ring = NULL;
+
+    for (int i = 0; i < 3; i++)
     {
-        printf("SendRawVNCFrame: framebuffer send failure");
-        VNC_Exit(server);
-        I_Quit();
-        return;
+        free(server->frames[i].pixels);
+        server->frames[i].pixels = NULL;
+    }
+
+    if (server->record != NULL)
+    {
+        fclose(server->record);
+        free(server->record_frame);
+        server->record = NULL;
+        server->record_frame = NULL;
     }
 }
 
-static void SendTightVNCFrame(vnc_server_t* server, byte* frame)
+#ifdef STANDALONE
+
+#include "m_misc.h"
+#include "z_zone.h"
+
+// vncbench plays a recording made with -vncrecord back through each of the
+// ways we can encode it, as fast as it can, and reports how each of them did
+
+typedef struct {
+    const char* name;
+    vnc_encoding_t encoding;
+    vnc_pixel_format_t pixel_format;
+
+    // The mode every update is encoded in, or VNC_MODE_COUNT to pick one
+    // for each update the way the sender does
+    vnc_mode_t mode;
+} vnc_bench_t;
+
+static const vnc_bench_t vnc_benches[] = {
+    {"raw, true color",          VNC_RAW,   VNC_TRUECOLOR, VNC_MODE_RAW},
+    {"raw, color map",           VNC_RAW,   VNC_COLORMAP,  VNC_MODE_RAW},
+    {"tight-stored, true color", VNC_TIGHT, VNC_TRUECOLOR, VNC_MODE_TIGHT_STORED},
+    {"tight-stored, color map",  VNC_TIGHT, VNC_COLORMAP,  VNC_MODE_TIGHT_STORED},
+    {"tight, true color",        VNC_TIGHT, VNC_TRUECOLOR, VNC_MODE_TIGHT},
+    {"tight, color map",         VNC_TIGHT, VNC_COLORMAP,  VNC_MODE_TIGHT},
+    {"picked, true color",       VNC_TIGHT, VNC_TRUECOLOR, VNC_MODE_COUNT},
+    {"picked, color map",        VNC_TIGHT, VNC_COLORMAP,  VNC_MODE_COUNT},
+};
+
+static uint32_t ReadNumber(byte** pos, int bytes)
 {
-    int offset = 0;
-    server->server_packet[offset++] = VNC_SERVER_FRAMEBUFFERUPDATE;
-    offset++; // Padding
-    server->server_packet[offset++] = 0; // Number of rectangles worth of pixel data, we only ever send the whole screen
-    server->server_packet[offset++] = 1;
-    server->server_packet[offset++] = 0; // X coordinate
-    server->server_packet[offset++] = 0;
-    server->server_packet[offset++] = 0; // Y coordinate
-    server->server_packet[offset++] = 0;
-    server->server_packet[offset++] = (server->width >> 8); // Width
-    server->server_packet[offset++] = server->width & 0xff;
-    server->server_packet[offset++] = (server->height >> 8); // Height
-    server->server_packet[offset++] = server->height & 0xff;
-    server->server_packet[offset++] = 0; // Tight encoding type
-    server->server_packet[offset++] = 0;
-    server->server_packet[offset++] = 0;
-    server->server_packet[offset++] = VNC_TIGHT;
-    if (SendAll(server->peer, server->server_packet, offset))
+    uint32_t value = 0;
+    for (int i = 0; i < bytes; i++)
     {
-        VNC_Exit(server);
-        I_Quit();
-        return;
+        value |= (*pos)[i] << (i * 8);
     }
 
-    offset = 0;
+    *pos += bytes;
+    return value;
+}
 
-    // Tight encoding is a compressed encoding that supports various options,
-    // including JPEG encoding, palettes and gradients. The only thing we care
-    // about here is palette support; Tight encoding supports palettes of 256
-    // colors which is exactly the size we need to use the frame data with no
-    // modification. See github.com/rfbproto/rfbproto for documentation.
-    // RFC 6143 doesn't describe this encoding.
-    //
-    // Tight is also a zlib-compressed encoding, which is less useful because
-    // I don't want to add zlib as a dependency. We can avoid actually having
-    // to use zlib by abusing a quirk of the RFC 1951 format: it supports
-    // blocks of data that are not compressed, and sets no limit on how they're
-    // used.
-    //
-    // Without compression the main complexity here is framing things. We have
-    // to use the RFC 1950 framing at the top-level, which looks like this:
-    //
-    // byte    0     1    ...        n+1 n+2 n+3 n+4
-    //      | CMF | FLG | <data>  |      ADLER32
-    //
-    // Where our CMF is going to be (01111000 - DEFLATE with 32K window),
-    // our FLG is going to be (0000001 - no dictionary, lowest compression level,
-    // and some extra juice to get the right flag check value) and the ADLER32
-    // checksum which is computed as follows over the frame data and stored in
-    // big-endian byte order:
-    //
-    //   s2 = (s2 + byte[i]) % 65521
-    //   s1 = (s1 + s2) % 65521
-    //   ...
-    //   ADLER32 = s2 << 16 | s1
-    //
-    // <data> is also composed of uncompressed DEFLATE blocks, which look like
-    // this:
-    //        0        1 2      3 4
-    //   | 00000000 | LENGTH | NLENGTH | <framedata>
-    //
-    // The first byte stores the block header (here, it's not the last block and
-    // has type 0), then the length (big-endian I assume) and the bitwise negation
-    // of the length.
-    //
-    // That continues until the last block, which has its first bit set to indicate
-    // that it's the last one in the stream.
-    //
-    // The Tight protocol itself is reasonably simple if you ignore the need to
-    // compress it. We can fit the whole rectangle into a single Tight block since
-    // we're never transmitting anything close to its limit (2048x2048).
+// Returns -1 if the length runs past the end of the recording
+static int ReadLength(byte** pos, byte* end)
+{
+    int value = 0;
+    for (int shift = 0; *pos < end && shift < 31; shift += 7)
+    {
+        byte next = *(*pos)++;
+        value |= (next & 0x7f) << shift;
+        if ((next & 0x80) == 0)
+        {
+            return value;
+        }
+    }
 
-    // We don't care about compression control, just reset stream 0 and always use
-    // stream 0. Also, always use basic compression which contains pixel data.
-    server->server_packet[offset++] = (1 << 6) | 1;
+    return -1;
+}
 
-    // Configure the palette filter and send the palette data
-    server->server_packet[offset++] = 1;
+// Reads a frame record into the frame, returning false if the recording
+// stops partway through it, such as when the game didn't get to close it
+static boolean ReadFrame(vnc_server_t* server, vnc_frame_t* frame, byte** pos, byte* end)
+{
+    int size = server->width * server->height;
 
-    // 256 total colors, followed by the colors themselves
-    server->server_packet[offset++] = 255;
-    int palette_pos = 0;
-    for (int i = 0; i < 256; i++)
+    if (end - *pos < 2)
     {
-        // Note that these are not endian-adjusted like in raw encoding, Tight
-        // specifies that RGB is packed in this order
-        server->server_packet[offset++] = server->palette[palette_pos++]; // Red
-        server->server_packet[offset++] = server->palette[palette_pos++]; // Green
-        server->server_packet[offset++] = server->palette[palette_pos++]; // Blue
+        return false;
     }
 
-    // Figure out how much data we're going to need to emulate the ZLIB stream, and
-    // then pack that into the Tight compact representation. We know that we'll need
-    // 6 bytes for the ZLIB framing, and then 5 bytes for each 64K block of palette
-    // indices (rounding up)
-    //
-    // Ideally we could just checkpoint the output here and come back to it, but we
-    // can't because the size itself is variable width and we have to know how many
-    // bytes it would take up in order to skip it
-    int zlib_data_size = 6;
-    int frame_data_size = server->width * server->height;
-    int zlib_frames = (frame_data_size >> 16) + 1;
-
-    zlib_data_size += frame_data_size + 5 * zlib_frames;
-    if (zlib_data_size < 0x80)
+    frame->move_count = ReadNumber(pos, 2);
+    if (frame->move_count > VNC_MAX_MOVES || end - *pos < frame->move_count * 12)
     {
-        server->server_packet[offset++] = zlib_data_size;
+        return false;
     }
-    else if (zlib_data_size < 0x4000)
+
+    for (int i = 0; i < frame->move_count; i++)
     {
-        server->server_packet[offset++] = (1 << 7) | (zlib_data_size & 0x7f);
-        server->server_packet[offset++] = (zlib_data_size >> 7) & 0x7f;
+        vnc_move_t* move = &frame->moves[i];
+        move->x = ReadNumber(pos, 2);
+        move->y = ReadNumber(pos, 2);
+        move->w = ReadNumber(pos, 2);
+        move->h = ReadNumber(pos, 2);
+        move->src_x = ReadNumber(pos, 2);
+        move->src_y = ReadNumber(pos, 2);
+
+        // A recording from a different sized screen, or a damaged one,
+        // can't be allowed to copy from outside the screen
+        if (move->x + move->w > server->width
+            || move->src_x + move->w > server->width
+            || move->y + move->h > server->height
+            || move->src_y + move->h > server->height)
+        {
+            return false;
+        }
     }
-    else
+
+    for (int p = 0; p < size; )
     {
-        server->server_packet[offset++] = (1 << 7) | (zlib_data_size & 0x7f);
-        server->server_packet[offset++] = (1 << 7) | ((zlib_data_size >> 7) & 0x7f);
-        server->server_packet[offset++] = (zlib_data_size >> 14) & 0xff;
+        int same = ReadLength(pos, end);
+        int different = ReadLength(pos, end);
+        if (same < 0 || different < 0 || same > size - p
+            || different > size - p - same || different > end - *pos)
+        {
+            return false;
+        }
+
+        p += same;
+        memcpy(frame->pixels + p, *pos, different);
+        *pos += different;
+        p += different;
     }
 
-    int zlib_data_start = offset;
+    return true;
+}
+
+static int CompareTimes(const void* a, const void* b)
+{
+    int64_t x = *(const int64_t*) a;
+    int64_t y = *(const int64_t*) b;
+    return x < y ? -1 : x > y;
+}
+
+// Returns false if the recording stopped partway through a record
+static boolean RunBench(vnc_server_t* server, const vnc_bench_t* bench, byte* data, int length, boolean copy)
+{
+    vnc_encoder_t* encoder = &server->encoders[NewEncoder(server, bench->encoding, bench->pixel_format)];
+    vnc_frame_t* frame = &server->frames[0];
+    int size = server->width * server->height;
+    int frames = 0;
+    int updates = 0;
+    int64_t bytes = 0;
+    int64_t total_us = 0;
+    int64_t* times = NULL;
+    int times_size = 0;
+    byte* pos = data + 12;
+    byte* end = data + length;
 
-    // Finally, write out our mock zlib data and compute the checksum as we do
-    int adler_s1 = 1;
-    int adler_s2 = 0;
-    // DEFLATE compression method with a window size of 9 (?)
-    server->server_packet[offset++] = (1 << 6) | (1 << 5) | (1 << 4) | (1 << 3);
-    // Check bits along with no dictionary and low compression level
-    server->server_packet[offset++] = 1;
+    encoder->members = 1;
+    memset(frame->pixels, 0, size);
 
-    int data_left = frame_data_size;
-    int zlib_block_capacity = 0;
-    for (int i = 0; i < frame_data_size; i++)
+    while (end - pos >= 5)
     {
-        if (zlib_block_capacity == 0)
+        byte type = *pos;
+        pos += 5;
+
+        if (type == VNC_RECORD_PALETTE)
         {
-            zlib_block_capacity = 0xffff;
-            if (data_left <= 0xffff)
+            rgb_t palette[256];
+
+            if (end - pos < 256 * 3)
             {
-                int data_left_hi = (data_left >> 8) & 0xff;
-                int data_left_lo = data_left & 0xff;
-                server->server_packet[offset++] = 1;
-                server->server_packet[offset++] = data_left_lo;
-                server->server_packet[offset++] = data_left_hi;
-                server->server_packet[offset++] = ~data_left_lo;
-                server->server_packet[offset++] = ~data_left_hi;
+                break;
             }
-            else
+
+            for (int i = 0; i < 256; i++)
             {
-                server->server_packet[offset++] = 0;
-                server->server_packet[offset++] = 0xff;
-                server->server_packet[offset++] = 0xff;
-                server->server_packet[offset++] = 0;
-                server->server_packet[offset++] = 0;
+                palette[i].r = pos[i * 3];
+                palette[i].g = pos[i * 3 + 1];
+                palette[i].b = pos[i * 3 + 2];
             }
-        }
 
-        adler_s1 += frame[i];
-        if (adler_s1 >= 65521)
+            VNC_PreparePalette(server, palette);
+            pos += 256 * 3;
+        }
+        else if (type == VNC_RECORD_INPUT)
         {
-            adler_s1 -= 65521;
+            if (end - pos < 2 || end - pos < 2 + pos[1])
+            {
+                break;
+            }
+
+            pos += 2 + pos[1];
         }
+        else if (type == VNC_RECORD_FRAME)
+        {
+            int64_t start;
+            boolean send_colormap;
+
+            if (!ReadFrame(server, frame, &pos, end))
+            {
+                break;
+            }
+
+            memcpy(frame->palette, server->next_palette, 256 * 3);
+            memcpy(frame->colors, server->next_colors, sizeof(frame->colors));
+            server->frame_seq++;
+
+            // Time everything the sender would do for the frame
+            start = GetTimeUS();
+            if (FindChanges(server, encoder, frame, copy, &send_colormap))
+            {
+                vnc_mode_t mode = bench->mode;
+                vnc_update_t* update;
+                if (mode == VNC_MODE_COUNT)
+                {
+                    mode = PickMode(encoder, DirtyPixels(server), VNC_DEFAULT_RATE);
+                }
+
+                update = EncodeUpdate(server, encoder, frame, send_colormap, mode);
+                bytes += update->size;
+                updates++;
+                update->refs++;
+                ReleaseUpdate(server, update);
+            }
+            else
+            {
+                encoder->frame_seq = server->frame_seq;
+            }
+
+            if (frames == times_size)
+            {
+                times_size = times_size == 0 ? 1024 : times_size * 2;
+                times = I_Realloc(times, times_size * sizeof(int64_t));
+            }
 
-        adler_s2 += adler_s1;
-        if (adler_s2 >= 65521)
+            times[frames] = GetTimeUS() - start;
+            total_us += times[frames];
+            frames++;
+        }
+        else
         {
-            adler_s2 -= 65521;
+            I_Error("RunBench: Unknown record type %d", type);
         }
-
-        server->server_packet[offset++] = frame[i];
-        zlib_block_capacity--;
-        data_left--;
     }
 
-    server->server_packet[offset++] = (adler_s2 >> 8) & 0xff;
-    server->server_packet[offset++] = adler_s2 & 0xff;
-    server->server_packet[offset++] = (adler_s1 >> 8) & 0xff;
-    server->server_packet[offset++] = adler_s1 & 0xff;
+    encoder->members = 0;
 
-    if (SendAll(server->peer, server->server_packet, offset))
+    if (frames == 0)
     {
-        printf("SendTightVNCFrame: framebuffer send failure");
-        VNC_Exit(server);
-        I_Quit();
-        return;
+        free(times);
+        return pos == end;
     }
+
+    qsort(times, frames, sizeof(int64_t), CompareTimes);
+    printf("%-26s %6d %12.0f %12.1f %12lld\n", bench->name, updates,
+           (double) bytes / frames, (double) total_us / frames,
+           (long long) times[(frames * 99 - 1) / 100]);
+    free(times);
+    return pos == end;
 }
 
-void VNC_SendFrame(vnc_server_t* server, byte* frame)
+int main(int argc, char *argv[])
 {
-    if (!server->send_frame)
-    {
-        return;
-    }
+    static vnc_server_t server;
+    byte *data;
+    byte *pos;
+    int length;
+    int width, height;
+    boolean copy = true;
+    boolean complete = true;
 
-    if (!server->palette)
+    if (argc < 2 || argc > 3 || (argc == 3 && strcmp(argv[2], "-nocopy") != 0))
     {
-        printf("VNC_PumpMessages: Deferring send until palette is availble\n");
-        return;
+        printf("Usage: %s <recording> [-nocopy]\n", argv[0]);
+        exit(-1);
     }
 
-    switch (server->encoding)
+    copy = argc == 2;
+
+    Z_Init();
+
+    length = M_ReadFile(argv[1], &data);
+    if (length < 12 || memcmp(data, VNC_RECORD_MAGIC, 8) != 0)
     {
-        case VNC_RAW:
-            SendRawVNCFrame(server, frame);
-            break;
-        case VNC_TIGHT:
-            SendTightVNCFrame(server, frame);
-            break;
+        fprintf(stderr, "%s is not a VNC recording\n", argv[1]);
+        exit(-1);
     }
 
-    server->send_frame = 0;
-}
+    pos = data + 8;
+    width = ReadNumber(&pos, 2);
+    height = ReadNumber(&pos, 2);
 
-void VNC_Exit(vnc_server_t* server)
-{
-    if (server->palette != NULL)
+    InitServer(&server, width, height);
+    server.listener = -1;
+
+    printf("%d by %d, moves %s\n\n", width, height, copy ? "sent as copies" : "ignored");
+    printf("%-26s %6s %12s %12s %12s\n", "", "updates", "bytes/frame", "us/frame", "99% us");
+
+    for (int i = 0; i < arrlen(vnc_benches); i++)
     {
-        free(server->palette);
-        server->palette = NULL;
+        complete = RunBench(&server, &vnc_benches[i], data, length, copy);
     }
 
-    if (server->server_packet != NULL)
+    if (!complete)
     {
-        free(server->server_packet);
-        server->server_packet = NULL;
+        printf("\nThe recording ends partway through a record, which was left out\n");
     }
 
-    close(server->peer);
+    VNC_Exit(&server);
+
+    return 0;
 }
+
+#endif
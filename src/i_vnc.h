@@ -21,22 +21,260 @@
 #define VNC_PACKET_SIZE 1024
 #define VNC_FRAME_SIZE 2048
 
+// Size of the square tiles we compare between frames when deciding which
+// parts of the screen have to be sent to the client
+#define VNC_TILE_SIZE 16
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <sys/uio.h>
+
 #include "doomtype.h"
+#include "deflate.h"
 
 typedef enum {
     VNC_RAW = 0,
+    VNC_COPYRECT = 1,
     VNC_TIGHT = 7,
 } vnc_encoding_t;
 
+// The pixel formats we can send. Doom draws with an indexed palette, so
+// clients that can keep a color map of their own can be sent the indices
+// as they are; everybody else gets 32-bit little-endian true color.
+typedef enum {
+    VNC_TRUECOLOR,
+    VNC_COLORMAP,
+} vnc_pixel_format_t;
+
+// The ways we can put an update together for a client. Clients that can
+// take Tight can be sent any of them, and each update uses whichever one we
+// expect to get it onto the client's screen soonest, given how long each has
+// been taking to encode and how fast the client's connection is.
+typedef enum {
+    VNC_MODE_RAW,
+    VNC_MODE_TIGHT_STORED, // Tight with its zlib data left uncompressed
+    VNC_MODE_TIGHT,
+    VNC_MODE_COUNT,
+} vnc_mode_t;
+
+// How we've been doing with one of the modes, as running averages per
+// changed pixel, so that they can be compared between updates of any size
+typedef struct {
+    double encode_us;
+    double bytes;
+
+    // How many updates have used the mode, and the encoder's update count
+    // when it was last used
+    int uses;
+    int last_used;
+} vnc_mode_stats_t;
+
+// Each mode gets tried again after this many updates without it, in case
+// things have changed since it was last measured
+#define VNC_MODE_PROBE 200
+
+// Until we've seen a client's connection back up, we assume it can take this
+// many bytes per millisecond (100 Mbit/s)
+#define VNC_DEFAULT_RATE 12500.0
+
+// The least we assume a client can take, in bytes per millisecond, however
+// little it has been taking. A stalled client would otherwise keep
+// averaging in nothing until its backlog couldn't be measured in time.
+#define VNC_MIN_RATE 1.0
+
+// Clients with more than this many milliseconds worth of data sitting in
+// their socket's send queue skip frames until it's gone down. Anything we
+// sent them would only be that much older by the time it arrived.
+#define VNC_BACKLOG_LIMIT 50
+
+// Shortest time between measurements of a client's connection speed, in
+// milliseconds
+#define VNC_RATE_SAMPLE 100
+
+// How often the statistics are printed when they're turned on, in
+// milliseconds
+#define VNC_STATS_INTERVAL 5000
+
+// Most clients we expect to have connected at once, counting the player
+#define VNC_MAX_CLIENTS 8
+
+// How long an update waits for slow clients to ask for it before they're
+// split off and left to catch up at their own pace, in milliseconds
+#define VNC_COHORT_WAIT 20
+
+// Tight lets us keep four zlib streams going at once. Stream 0 carries
+// ordinary updates, and the rest each carry one band of the screen whenever
+// the whole thing has to be sent to a true color client, which is usually
+// because the palette changed.
+#define VNC_TIGHT_STREAMS 4
+#define VNC_TIGHT_BANDS (VNC_TIGHT_STREAMS - 1)
+#define VNC_TIGHT_RESET_ALL ((1 << VNC_TIGHT_STREAMS) - 1)
+
+// Room for the small messages queued on vnc_client_t.control. A fence with
+// the longest payload the protocol allows takes 73 bytes.
+#define VNC_CONTROL_SIZE 256
+
+// Limits on how many bytes of continuous updates a client can have in flight
+// before it acknowledges them, and where each client starts out
+#define VNC_WINDOW_MIN (16 * 1024)
+#define VNC_WINDOW_START (256 * 1024)
+#define VNC_WINDOW_MAX (4 * 1024 * 1024)
+
+// How much longer than the shortest round trip we've seen a fence can take
+// before we assume our updates are piling up in a queue somewhere, in
+// milliseconds
+#define VNC_RTT_SLACK 25
+
+// Set on vnc_server_t.ready_frame when the slot holds a frame that the sender
+// thread hasn't picked up yet
+#define VNC_FRAME_FRESH 0x4
+
+// The stages that the player's input goes through on its way back to them as
+// a frame, which latency statistics are kept for when they're turned on
+typedef enum {
+    VNC_LATENCY_QUEUE,  // Arriving on the socket to being read by the game
+    VNC_LATENCY_TIC,    // Being read to the first tic built after it being run
+    VNC_LATENCY_RENDER, // The tic being run to a frame being drawn
+    VNC_LATENCY_WAIT,   // The frame being handed over to the client being
+                        // ready for it and the sender starting on it
+    VNC_LATENCY_ENCODE, // Encoding the frame
+    VNC_LATENCY_SEND,   // The update being encoded to it all being written
+    VNC_LATENCY_TOTAL,
+    VNC_LATENCY_COUNT,
+} vnc_latency_stage_t;
+
+// Latencies are counted in buckets this many microseconds wide, the last of
+// which also takes everything longer
+#define VNC_LATENCY_BUCKET_US 100
+#define VNC_LATENCY_BUCKETS 1000
+
+typedef struct {
+    int counts[VNC_LATENCY_BUCKETS];
+    int samples;
+    int64_t total_us;
+    int64_t max_us;
+} vnc_histogram_t;
+
+// One input from the player being followed through to the first frame that
+// could show its effect. client is where it came from, or -1 if there's
+// nothing being followed, and tic the tic its effect was built into, or -1
+// if there hasn't been one yet. The rest are when it reached each stage, in
+// microseconds. Only one input is followed at a time, and the rest are left
+// out of the statistics.
+typedef struct {
+    int client;
+    int tic;
+    int64_t arrived;
+    int64_t read;
+    int64_t ran;
+    int64_t drawn;
+    int64_t encoding;
+    int64_t encoded;
+} vnc_probe_t;
+
+// Most moves the game can hint at for a single frame. Any more are ignored,
+// which only costs us the bandwidth they would have saved.
+#define VNC_MAX_MOVES 256
+
+// Part of the previous frame that the game has moved somewhere else on the
+// screen, such as a column of the screen melt. Clients that understand
+// CopyRect can copy it from where it was rather than being sent it again.
+typedef struct {
+    // Where the pixels ended up, and where they were before
+    int x, y, w, h;
+    int src_x, src_y;
+} vnc_move_t;
+
+// A finished frame along with the palette it was drawn with, both as it is
+// and as the 32-bit pixels true color clients are sent for each index, and
+// the moves that took the frame before it to this one, and the input whose
+// effect it's the first to show, if that's being followed
+typedef struct {
+    byte *pixels;
+    byte palette[256 * 3];
+    uint32_t colors[256];
+    vnc_move_t moves[VNC_MAX_MOVES];
+    int move_count;
+    vnc_probe_t probe;
+} vnc_frame_t;
+
+// A copy of the screen that updates can send pixels straight out of, rather
+// than copying them. It's freed once neither its encoder nor any update is
+// using it. (sender)
+typedef struct {
+    byte *pixels;
+    int refs;
+} vnc_pixels_t;
+
+// An encoded framebuffer update that's shared between all the clients it's
+// being sent to, and recycled once the last of them has it (sender)
+typedef struct {
+    // Where everything we generate for the update is written, which can hold
+    // the largest update we could ever send
+    byte *data;
+
+    // The pieces of the update in the order they're sent, along with their
+    // total size. Most of them point into data, but some point into pixels.
+    struct iovec *pieces;
+    int piece_count;
+    int size;
+    vnc_pixels_t *pixels;
+
+    int refs;
+} vnc_update_t;
+
+// Spare updates kept around to be reused instead of allocated again
+#define VNC_SPARE_UPDATES (VNC_MAX_CLIENTS * 2)
+
+// Most pieces of an update handed to the socket at once
+#define VNC_SEND_PIECES 64
+
+// Updates at least this large are sent with MSG_ZEROCOPY when it's turned on.
+// Below this, setting up the transfer costs more than copying would.
+#define VNC_ZEROCOPY_MIN (64 * 1024)
+
+// Most zero-copy sends a client can have waiting on the kernel to finish
+// with them, after which further sends are copied as usual
+#define VNC_ZEROCOPY_HELD 16
+
+// Game sound waiting to be sent is kept in a ring of this many stereo frames,
+// which has to be a power of two
+#define VNC_AUDIO_RING 65536
+
+// Clients that fall further behind the sound than this, in milliseconds, skip
+// ahead rather than hearing it late
+#define VNC_AUDIO_MAX_LAG 250
+
+// Most frames of sound sent to a client in one message
+#define VNC_AUDIO_CHUNK 4096
+
+typedef enum {
+    VNC_CLIENT_FREE,
+
+    // Going through the handshake, waiting for the client's version string,
+    // its choice of security type, and then its ClientInit. Clients in these
+    // states belong entirely to the game thread.
+    VNC_CLIENT_VERSION,
+    VNC_CLIENT_SECURITY,
+    VNC_CLIENT_INIT,
+
+    // Finished the handshake and receiving updates
+    VNC_CLIENT_ACTIVE,
+} vnc_client_state_t;
+
 typedef struct {
     // The file descriptor we actually send network data on, comes from
-    // accept() on server socket. Once this connection closes we kill the 
-    // game.
+    // accept() on the listening socket
     int peer;
+    vnc_client_state_t state;
 
-    // Whether the client has sent a framebuffer update request that we need to
-    // honor when the next frame is drawn.
-    boolean send_frame;
+    // Set by whichever thread first notices that the client is gone. Active
+    // clients are only closed by the sender, once the game thread has seen
+    // that they're dead and set released, so that neither thread is ever left
+    // reading from a closed descriptor. (lock)
+    boolean dead;
+    boolean released;
 
     // The buffer that we use for receiving packets over the connection. This is
     // used to contain commands that we have received in part but have not gotten
@@ -47,21 +285,306 @@ typedef struct {
     // blob of partial packet data to.
     int packet_cursor;
 
+    // Whether the client has sent a framebuffer update request that we need to
+    // honor when the next frame is drawn, and whether that update has to
+    // cover the whole screen. (lock)
+    boolean send_frame;
+    boolean full_refresh;
+
+    // The preferred encoding sent to us by the client. Note that this refers to
+    // the frame encoding and not the pixel encoding, which is pixel_format
+    // below. (lock)
+    vnc_encoding_t encoding;
+    boolean encoding_changed;
+
+    // The pixel format the client asked for with SetPixelFormat (lock)
+    vnc_pixel_format_t pixel_format;
+    boolean pixel_format_changed;
+
+    // Whether the client listed the Fence and ContinuousUpdates
+    // pseudo-encodings. Continuous updates are only offered to clients that
+    // can do fences too, since otherwise we'd have no idea how far behind
+    // they are. (lock)
+    boolean fence_supported;
+    boolean continuous_supported;
+
+    // Whether the client listed CopyRect, which it needs for any of the
+    // game's moves to be sent as copies (lock)
+    boolean copyrect_supported;
+
+    // Set while the client has continuous updates turned on, in which case it
+    // gets each new frame without having to ask for it (lock)
+    boolean continuous;
+
+    // Whether the client listed the QEMU Audio pseudo-encoding, whether it has
+    // sound turned on, and the format it wants it in. audio_read is how much
+    // of the server's sound the client has been sent, and audio_frac how far
+    // it is between two frames of it, in 16.16 fixed point, when the client's
+    // rate is different from ours. (lock)
+    boolean audio_supported;
+    boolean audio_enabled;
+    int audio_format;
+    int audio_channels;
+    int audio_frequency;
+    uint32_t audio_read;
+    uint32_t audio_frac;
+
+    // Messages that have to go out between updates, like the answers to the
+    // client's fences. Only the sender can write to an active client, so these
+    // are queued up and written once the current update is done. (lock)
+    byte control[VNC_CONTROL_SIZE];
+    int control_size;
+
+    // Flow control for continuous updates. Each update we push is followed by
+    // a fence carrying the number of bytes sent so far, and the client's
+    // answer tells us how many of those have arrived. New updates are held
+    // back while window bytes or more are still on their way, and the window
+    // shrinks whenever the round trip grows well past min_rtt. backoff_mark
+    // is bytes_sent as of the last time it shrank, so that it only shrinks
+    // once for the updates that were already on their way. (lock)
+    uint32_t bytes_sent;
+    uint32_t bytes_acked;
+    uint32_t backoff_mark;
+    int window;
+    int min_rtt;
+
+    // The encoder whose updates this client receives, or -1 if it hasn't been
+    // given one yet (sender)
+    int encoder;
+
+    // The update currently being written to the client, how much of it has
+    // been written so far, and where that leaves us in its pieces. The client
+    // isn't given another until this one is done. (sender)
+    vnc_update_t *out;
+    int out_offset;
+    int out_piece;
+    int out_piece_offset;
+
+    // Whether the client's socket takes MSG_ZEROCOPY, and the updates the
+    // kernel may still be reading from because of it. Each is kept along with
+    // the number of the last send that used it; the kernel numbers a socket's
+    // zero-copy sends from zero and reports on its error queue once it's done
+    // with them. (sender)
+    boolean zerocopy;
+    vnc_update_t *zerocopy_held[VNC_ZEROCOPY_HELD];
+    uint32_t zerocopy_last[VNC_ZEROCOPY_HELD];
+    int zerocopy_count;
+    uint32_t zerocopy_next;
+
+    // Connection statistics (sender). rate is our estimate of how many bytes
+    // per millisecond the connection can carry, measured by how fast data
+    // leaves the socket's send queue while the queue stays busy. The sample
+    // fields are the time of the last measurement, how much had left the
+    // queue by then, and whether there was anything left in it. backlog is
+    // how much was in the queue when we last looked. write_ms is how long
+    // updates take to be handed over to the socket, counted from out_start.
+    // dropped counts the frames skipped because of the backlog, and
+    // dropped_seq is the last one.
+    double rate;
+    double write_ms;
+    uint32_t written;
+    int backlog;
+    int sample_time;
+    uint32_t sample_delivered;
+    boolean sample_busy;
+    int out_start;
+    int dropped;
+    int dropped_seq;
+
+    // The input being followed, if out is the first update to show its
+    // effect (sender)
+    vnc_probe_t probe;
+} vnc_client_t;
+
+// The state of the screen as seen by a group of clients. Every client in the
+// group has been sent exactly the same updates, so each new frame only has to
+// be encoded once for all of them. (sender)
+typedef struct {
+    int members;
+    vnc_encoding_t encoding;
+    vnc_pixel_format_t pixel_format;
+
+    // The frame the members currently have on their screens, as of the last
+    // update. New frames are diffed against this so that we only have to send
+    // the parts that changed. For color map clients, the palette is the color
+    // map they have. Updates can point into last_frame while they're being
+    // sent, in which case the next frame gets a fresh copy.
+    vnc_pixels_t *last_frame;
+    byte palette[256 * 3];
+    uint32_t colors[256];
+
+    // The sequence number of the frame in last_frame, or -1 if the members
+    // need the whole screen
+    int frame_seq;
+
+    // Tight's zlib streams, and a bit for each one that has to be reset the
+    // next time it's used. The members have to be told to reset their end
+    // whenever we reset ours. The band streams are only set up once they're
+    // needed.
+    deflate_stream_t tight_streams[VNC_TIGHT_STREAMS];
+    int tight_reset;
+    boolean tight_bands_ready;
+
+    // How much data was last compressed onto each stream. A band stream's
+    // last data is the previous copy of that band, so this is how far back
+    // to look for the parts of it that haven't changed.
+    int tight_last_size[VNC_TIGHT_STREAMS];
+
+    // When we started holding an update back for members that haven't asked
+    // for it yet, or -1 if we aren't
+    int wait_start;
+
+    // How each of the modes has been doing for this group, the mode that was
+    // used last, how many updates have been sent, and their average size
+    vnc_mode_stats_t modes[VNC_MODE_COUNT];
+    vnc_mode_t mode;
+    int updates;
+    double update_bytes;
+} vnc_encoder_t;
+
+typedef struct {
+    // The socket we accept new clients on. This stays open for the whole game
+    // so that players and spectators can join at any time.
+    int listener;
+
+    // Everybody connected to us. Only one of them, the controller, has its
+    // input passed on to the game; the rest can only watch.
+    vnc_client_t clients[VNC_MAX_CLIENTS];
+    int controller;
+
+    // The thread that encodes frames and writes them to the clients, so that a
+    // slow connection can't hold up the game loop. Everything marked (sender)
+    // belongs to that thread; everything else belongs to the game except
+    // where noted.
+    pthread_t sender;
+    boolean sender_running;
+
+    // Written to by the game to wake up the sender, either because a new frame
+    // is ready or because a client asked for one
+    int wake_pipe[2];
+
+    // Set by the sender if it stops unexpectedly. The game notices this the
+    // next time it pumps messages and shuts down.
+    atomic_int sender_failed;
+    atomic_int shutting_down;
+
+    // Whether any client is ready for a frame that it hasn't been sent yet.
+    // The sender works this out each time it looks at the clients, and the
+    // game sets it as soon as a client asks, so that it doesn't have to wait
+    // on the sender to find out.
+    atomic_int frame_wanted;
+
+    // Triple buffer of frames handed from the game to the sender. The game
+    // draws into frames[back_frame] and then swaps it with ready_frame. The
+    // sender swaps ready_frame with front_frame when it wants the latest
+    // frame. Neither side ever waits on the other, and frames that the sender
+    // didn't get around to sending are just overwritten.
+    vnc_frame_t frames[3];
+    int back_frame;
+    atomic_int ready_frame;
+    int front_frame; // (sender)
+    boolean have_frame; // (sender)
+
+    // Counts the frames the sender has picked up (sender)
+    int frame_seq;
+
+    // The palette the game has most recently set, and the moves it's hinted at
+    // since the last frame, copied into each frame
+    byte next_palette[256 * 3];
+    uint32_t next_colors[256];
+    boolean have_palette;
+    vnc_move_t next_moves[VNC_MAX_MOVES];
+    int next_move_count;
+
+    // Guards the fields marked (lock), which are shared between the game
+    // thread handling client messages and the sender, as well as the state of
+    // each client slot.
+    pthread_mutex_t lock;
+
+    // Set before VNC_Init to have the sender print the statistics it keeps
+    // every VNC_STATS_INTERVAL, along with the modes it's been picking
+    boolean show_stats;
+
+    // Set before VNC_Init to send large updates with MSG_ZEROCOPY where the
+    // platform has it. This saves copying them into the kernel, but the
+    // kernel has to tell us when it's done with each one.
+    boolean zerocopy;
+    int stats_time; // (sender)
+
+    // Set before VNC_Init to record the palettes and frames the game hands
+    // us, along with the input clients send, to a file that vncbench can play
+    // back. Each frame is stored as its changes from record_frame, the last
+    // one recorded, and is timed from record_start.
+    const char* record_path;
+    FILE* record;
+    byte* record_frame;
+    int record_start;
+
+    // When the statistics are on, how long the player's input is taking to
+    // get through each stage since they were last printed (sender)
+    vnc_histogram_t latency[VNC_LATENCY_COUNT];
+
+    // The input being followed until it's drawn, and when the data the game
+    // is reading from a client arrived and was read, in microseconds. The
+    // arrival time comes from the kernel where it can tell us.
+    vnc_probe_t probe;
+    int64_t read_arrived;
+    int64_t read_time;
+
+    // The input from the latest frame the sender picked up, until it goes out
+    // in an update to the client it came from (sender)
+    vnc_probe_t frame_probe;
+
+    // The rate of the game's sound, in frames per second, set before VNC_Init
+    // to offer it to clients, or 0 if there isn't any. The sound is 16-bit
+    // stereo and kept in audio_ring, with audio_written frames written so far.
+    // (lock)
+    int audio_rate;
+    int16_t *audio_ring;
+    uint32_t audio_written;
+
     // Whether the user is currently in text input. Affects how we translate VNC key
     // events into game key events
     boolean text_input;
 
-    // The preferred encoding sent to us by the client. Note that this refers to
-    // the frame encoding and not the pixel encoding; we support only 32-bit
-    // little-endian true-color as a pixel encoding
-    vnc_encoding_t encoding;
+    // One per group of clients that are in step with each other (sender)
+    vnc_encoder_t encoders[VNC_MAX_CLIENTS];
 
-    // Where data is stored before being sent to the client, used for both control
-    // data and color data
+    // The update being built and its buffer, which everything that writes
+    // part of an update writes into. piece_start is where the next piece
+    // begins. (sender)
+    vnc_update_t *building;
     byte *server_packet;
+    int piece_start;
+
+    // How big an update's buffer and list of pieces have to be to hold any
+    // update, and the spare updates waiting to be reused (sender)
+    int update_capacity;
+    int piece_capacity;
+    vnc_update_t *spare_updates[VNC_SPARE_UPDATES];
+    int spare_count;
+
+    // One entry per tile, nonzero if the tile differs from last_frame (sender)
+    byte *dirty_tiles;
+    int tiles_x, tiles_y;
 
-    // The palette to be pushed over with the next frame, 256*6 bytes
-    byte *palette;
+    // The rectangles (x, y, w, h in pixels) covering the dirty tiles of the
+    // frame being sent, and how many of them there are. If they're the bands
+    // covering the whole screen, rect i goes on Tight stream i + 1. (sender)
+    int *rects;
+    int rect_count;
+    boolean rects_banded;
+
+    // The moves that are being sent as CopyRect ahead of those rectangles,
+    // and the encoder's last frame with them applied, which is what the
+    // rectangles are found against (sender)
+    vnc_move_t copies[VNC_MAX_MOVES];
+    int copy_count;
+    byte *moved_frame;
+
+    // Scratch space used by Tight to remap a rectangle onto its own palette
+    // (sender)
+    byte *tight_indices;
 
     // The last recorded positions of the mouse. Required since mouse events are relative.
     int mouse_x, mouse_y;
@@ -70,26 +593,51 @@ typedef struct {
     int width, height;
 } vnc_server_t;
 
-// Waits for a client to connect and perform the initial handshake, then fills in the
-// connection data within the server state record. 
-void VNC_Init(vnc_server_t* server, int width, int height);
+// Starts listening for clients on the given IPv4 address (an empty string for
+// all of them) and port. This doesn't wait for anybody; clients can come and
+// go whenever they like while the game runs, and the first to arrive while
+// nobody has control gets it.
+void VNC_Init(vnc_server_t* server, int width, int height, const char* address, int port);
 
 // Toggles text input, which includes more info when we generate key events
 void VNC_SetTextInput(vnc_server_t* server, boolean state);
 
-// Reads all the pending messages on the socket and processes them. This will fill
-// the client_packet with any leftover data that was not part of a complete packet.
+// Accepts any new clients and processes all the pending messages from the
+// existing ones. This will fill each client_packet with any leftover data that
+// was not part of a complete packet.
 void VNC_PumpMessages(vnc_server_t* server);
 
 // Saves the current palette to be sent over before the next frame.
 void VNC_PreparePalette(vnc_server_t* server, rgb_t* palette);
 
-// Sends over the current frame of video data, if the client has requested it.
+// Hands the current frame of video data over to the sender thread, which sends
+// it to each client once they've requested it, or right away to clients with
+// continuous updates on. This never waits on the network.
 void VNC_SendFrame(vnc_server_t* server, byte* frame);
 
-// Terminates the VNC connection. Usually this will be handled internally when the
-// client hangs up on us, but if the user goes through the trouble to hit "Exit Game"
-// then the cleanup also happens externally here.
+// Whether any client is waiting on a new frame. Games that only draw frames
+// when somebody is going to see them check this before drawing.
+boolean VNC_FrameWanted(vnc_server_t* server);
+
+// Lets the server know that the game has built the commands for the given
+// tic, and that it's run them, so that it can tell how long the player's
+// input waits on the game loop. Only used for the latency statistics.
+void VNC_TicBuilt(vnc_server_t* server, int tic);
+void VNC_TicRun(vnc_server_t* server, int tic);
+
+// Hints that the w by h pixels at (x, y) of the last frame passed to
+// VNC_SendFrame will be found dx, dy pixels away in the next one. Wrong hints
+// cost a little time but are otherwise harmless.
+void VNC_MoveRect(vnc_server_t* server, int x, int y, int w, int h, int dx, int dy);
+
+// Hands frames of 16-bit stereo sound at audio_rate over to the sender thread,
+// which sends them to the clients that have sound turned on ahead of the next
+// frame. This never waits on the network either.
+void VNC_SendAudio(vnc_server_t* server, const int16_t* samples, int frames);
+
+// Terminates all the VNC connections and stops the server. Called at shutdown,
+// and by VNC_PumpMessages if the sender thread fails. The game keeps running
+// when the last client hangs up, so that alone doesn't end up here.
 void VNC_Exit(vnc_server_t* server);
 
 #endif
@@ -0,0 +1,399 @@
+//
+// Copyright(C) 2021 Chris Marchetti <adamnew123456@gmail.com>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//     Sound effects and OPL music mixed in-process and streamed to VNC
+//     clients, for servers that don't have anywhere to play sound.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "deh_str.h"
+#include "i_sound.h"
+#include "i_system.h"
+#include "i_timer.h"
+#include "i_vnc.h"
+#include "m_misc.h"
+#include "opl.h"
+#include "w_wad.h"
+#include "z_zone.h"
+
+#include "doomtype.h"
+
+#define NUM_CHANNELS 16
+
+// Most frames of audio mixed at once
+#define MIX_FRAMES 1024
+
+// A sound effect converted to 16-bit mono at the mixing rate
+typedef struct
+{
+    int16_t *samples;
+    int length;
+} vnc_sound_t;
+
+typedef struct
+{
+    // The sound playing, or NULL if the channel is free
+    vnc_sound_t *sound;
+
+    // Position in the sound and how far it moves each frame, both in 16.16
+    // fixed point so that pitch shifted sounds can move at other speeds
+    uint64_t position;
+    unsigned int step;
+
+    // Volume of each side, 0-255
+    int left, right;
+} vnc_channel_t;
+
+// The server that the mix is sent to
+extern vnc_server_t vnc_server;
+
+static boolean sound_initialized = false;
+static boolean use_sfx_prefix;
+
+static vnc_channel_t channels[NUM_CHANNELS];
+
+// Mixing happens in step with the clock rather than with the game's frame
+// rate. These are when the first frame was mixed and how many have been
+// mixed since.
+static boolean clock_started;
+static int clock_start;
+static uint64_t frames_mixed;
+
+static int mix_accum[MIX_FRAMES * 2];
+static int16_t mix_buffer[MIX_FRAMES * 2];
+
+// Load and convert a sound effect
+// Returns NULL if it's not a valid sound
+
+static vnc_sound_t *CacheSFX(sfxinfo_t *sfxinfo)
+{
+    int lumpnum;
+    unsigned int lumplen;
+    int samplerate;
+    unsigned int length;
+    byte *data;
+    vnc_sound_t *sound;
+
+    lumpnum = sfxinfo->lumpnum;
+    data = W_CacheLumpNum(lumpnum, PU_STATIC);
+    lumplen = W_LumpLength(lumpnum);
+
+    // Check the header, and ensure this is a valid sound. See CacheSFX in
+    // i_sdlsound.c for the details of the format.
+
+    if (lumplen < 8
+     || data[0] != 0x03 || data[1] != 0x00)
+    {
+        W_ReleaseLumpNum(lumpnum);
+        return NULL;
+    }
+
+    samplerate = (data[3] << 8) | data[2];
+    length = (data[7] << 24) | (data[6] << 16) | (data[5] << 8) | data[4];
+
+    if (length > lumplen - 8 || length <= 48 || samplerate == 0)
+    {
+        W_ReleaseLumpNum(lumpnum);
+        return NULL;
+    }
+
+    data += 16;
+    length -= 32;
+
+    // Resample to the mixing rate, interpolating between the unsigned
+    // 8-bit samples of the original
+
+    sound = malloc(sizeof(vnc_sound_t));
+    sound->length = (int) (((uint64_t) length * snd_samplerate) / samplerate);
+    sound->samples = malloc(sound->length * sizeof(int16_t));
+
+    for (int i = 0; i < sound->length; ++i)
+    {
+        uint64_t src = ((uint64_t) i * samplerate << 16) / snd_samplerate;
+        unsigned int index = src >> 16;
+        int frac = src & 0xffff;
+        int a = data[8 + index] - 128;
+        int b = index + 1 < length ? data[8 + index + 1] - 128 : a;
+
+        sound->samples[i] = (int16_t) (((a << 16) + (b - a) * frac) >> 8);
+    }
+
+    W_ReleaseLumpNum(lumpnum);
+
+    return sound;
+}
+
+static void GetSfxLumpName(sfxinfo_t *sfx, char *buf, size_t buf_len)
+{
+    // Linked sfx lumps? Get the lump number for the sound linked to.
+
+    if (sfx->link != NULL)
+    {
+        sfx = sfx->link;
+    }
+
+    // Doom adds a DS* prefix to sound lumps; Heretic and Hexen don't
+    // do this.
+
+    if (use_sfx_prefix)
+    {
+        M_snprintf(buf, buf_len, "ds%s", DEH_String(sfx->name));
+    }
+    else
+    {
+        M_StringCopy(buf, DEH_String(sfx->name), buf_len);
+    }
+}
+
+static int I_VNC_GetSfxLumpNum(sfxinfo_t *sfx)
+{
+    char namebuf[9];
+
+    GetSfxLumpName(sfx, namebuf, sizeof(namebuf));
+
+    return W_GetNumForName(namebuf);
+}
+
+static void I_VNC_UpdateSoundParams(int handle, int vol, int sep)
+{
+    int left, right;
+
+    if (!sound_initialized || handle < 0 || handle >= NUM_CHANNELS)
+    {
+        return;
+    }
+
+    left = ((254 - sep) * vol) / 127;
+    right = ((sep) * vol) / 127;
+
+    if (left < 0) left = 0;
+    else if ( left > 255) left = 255;
+    if (right < 0) right = 0;
+    else if (right > 255) right = 255;
+
+    channels[handle].left = left;
+    channels[handle].right = right;
+}
+
+static int I_VNC_StartSound(sfxinfo_t *sfxinfo, int channel, int vol, int sep, int pitch)
+{
+    vnc_sound_t *sound;
+
+    if (!sound_initialized || channel < 0 || channel >= NUM_CHANNELS)
+    {
+        return -1;
+    }
+
+    // Sounds are converted the first time they're played and kept
+    // from then on
+
+    if (sfxinfo->driver_data == NULL)
+    {
+        sfxinfo->driver_data = CacheSFX(sfxinfo);
+
+        if (sfxinfo->driver_data == NULL)
+        {
+            return -1;
+        }
+    }
+
+    sound = sfxinfo->driver_data;
+
+    channels[channel].sound = sound;
+    channels[channel].position = 0;
+    channels[channel].step = 1 << 16;
+
+    // The same approximation of vanilla's pitch shifting as the SDL module
+
+    if (snd_pitchshift && pitch != NORM_PITCH && pitch < 2 * NORM_PITCH)
+    {
+        channels[channel].step = (NORM_PITCH << 16) / (2 * NORM_PITCH - pitch);
+    }
+
+    I_VNC_UpdateSoundParams(channel, vol, sep);
+
+    return channel;
+}
+
+static void I_VNC_StopSound(int handle)
+{
+    if (!sound_initialized || handle < 0 || handle >= NUM_CHANNELS)
+    {
+        return;
+    }
+
+    channels[handle].sound = NULL;
+}
+
+static boolean I_VNC_SoundIsPlaying(int handle)
+{
+    if (!sound_initialized || handle < 0 || handle >= NUM_CHANNELS)
+    {
+        return false;
+    }
+
+    return channels[handle].sound != NULL;
+}
+
+// Mix the next frames of sound effects into mix_buffer and add the music
+
+static void MixFrames(int frames)
+{
+    memset(mix_accum, 0, frames * 2 * sizeof(int));
+
+    for (int c = 0; c < NUM_CHANNELS; ++c)
+    {
+        vnc_channel_t *channel = &channels[c];
+
+        for (int i = 0; i < frames && channel->sound != NULL; ++i)
+        {
+            unsigned int index = channel->position >> 16;
+            int sample;
+
+            if (index >= channel->sound->length)
+            {
+                channel->sound = NULL;
+                break;
+            }
+
+            sample = channel->sound->samples[index];
+            mix_accum[i * 2] += sample * channel->left;
+            mix_accum[i * 2 + 1] += sample * channel->right;
+            channel->position += channel->step;
+        }
+    }
+
+    for (int i = 0; i < frames * 2; ++i)
+    {
+        int sample = mix_accum[i] >> 8;
+
+        if (sample < -32768) sample = -32768;
+        else if (sample > 32767) sample = 32767;
+
+        mix_buffer[i] = sample;
+    }
+
+    OPL_Render(mix_buffer, frames);
+}
+
+//
+// Periodically called to update the sound system. Mixes however much
+// sound has come due since the last call and sends it to the clients.
+//
+
+static void I_VNC_UpdateSound(void)
+{
+    int now;
+    uint64_t due;
+    uint64_t frames;
+
+    if (!sound_initialized)
+    {
+        return;
+    }
+
+    now = I_GetTimeMS();
+
+    if (!clock_started)
+    {
+        clock_started = true;
+        clock_start = now;
+        frames_mixed = 0;
+    }
+
+    due = ((uint64_t) (now - clock_start) * snd_samplerate) / 1000;
+    frames = due - frames_mixed;
+
+    // After a long stall (loading a level, say) it's too late for the sound
+    // that should have played during it. Pick up from now instead.
+
+    if (frames > snd_samplerate / 4)
+    {
+        frames_mixed = due - snd_samplerate / 4;
+        frames = snd_samplerate / 4;
+    }
+
+    while (frames > 0)
+    {
+        int chunk = frames < MIX_FRAMES ? frames : MIX_FRAMES;
+
+        MixFrames(chunk);
+        VNC_SendAudio(&vnc_server, mix_buffer, chunk);
+        frames -= chunk;
+        frames_mixed += chunk;
+    }
+}
+
+static void I_VNC_ShutdownSound(void)
+{
+    sound_initialized = false;
+}
+
+static void I_VNC_PrecacheSounds(sfxinfo_t *sounds, int num_sounds)
+{
+    // no-op
+}
+
+static boolean I_VNC_InitSound(boolean _use_sfx_prefix)
+{
+    int i;
+
+    use_sfx_prefix = _use_sfx_prefix;
+
+    for (i=0; i<NUM_CHANNELS; ++i)
+    {
+        channels[i].sound = NULL;
+    }
+
+    clock_started = false;
+
+    // The music is part of the same mix, so OPL output has to be generated
+    // here rather than played locally. The VNC server isn't running yet, but
+    // has to know there's going to be sound when it starts.
+
+    OPL_SetExternalMixing(1);
+    vnc_server.audio_rate = snd_samplerate;
+
+    sound_initialized = true;
+
+    return true;
+}
+
+static snddevice_t sound_vnc_devices[] =
+{
+    SNDDEVICE_SB,
+    SNDDEVICE_PAS,
+    SNDDEVICE_GUS,
+    SNDDEVICE_WAVEBLASTER,
+    SNDDEVICE_SOUNDCANVAS,
+    SNDDEVICE_AWE32,
+};
+
+sound_module_t sound_vnc_module =
+{
+    sound_vnc_devices,
+    arrlen(sound_vnc_devices),
+    I_VNC_InitSound,
+    I_VNC_ShutdownSound,
+    I_VNC_GetSfxLumpNum,
+    I_VNC_UpdateSound,
+    I_VNC_UpdateSoundParams,
+    I_VNC_StartSound,
+    I_VNC_StopSound,
+    I_VNC_SoundIsPlaying,
+    I_VNC_PrecacheSounds,
+};
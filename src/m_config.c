@@ -828,6 +828,19 @@ static default_t extra_defaults_list[] =
 
     CONFIG_VARIABLE_INT(png_screenshots),
 
+    //!
+    // IPv4 address of the network interface to accept VNC clients on. If
+    // this is an empty string, clients are accepted on every interface.
+    //
+
+    CONFIG_VARIABLE_STRING(vnc_address),
+
+    //!
+    // TCP port to accept VNC clients on.
+    //
+
+    CONFIG_VARIABLE_INT(vnc_port),
+
     //!
     // Sound output sample rate, in Hz.  Typical values to use are
     // 11025, 22050, 44100 and 48000.
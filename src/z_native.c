@@ -45,6 +45,10 @@ struct memblock_s
  
 static memblock_t *allocated_blocks[PU_NUM_TAGS];
 
+// Called before cached blocks are freed to make room
+
+static void (*purge_callback)(void);
+
 #ifdef TESTING
 
 static int test_malloced = 0;
@@ -144,6 +148,11 @@ void Z_Free (void* ptr)
     {
         I_Error ("Z_Free: freed a pointer without ZONEID");
     }
+
+    if (block->tag >= PU_PURGELEVEL && purge_callback != NULL)
+    {
+        purge_callback();
+    }
 		
     if (block->tag != PU_FREE && block->user != NULL)
     {
@@ -179,6 +188,11 @@ static boolean ClearCache(int size)
         return false;
     }
 
+    if (purge_callback != NULL)
+    {
+        purge_callback();
+    }
+
     // Search to the end of the PU_CACHE list.  The blocks at the end
     // of the list are the ones that have been free for longer and
     // are more likely to be unneeded now.
@@ -496,3 +510,8 @@ unsigned int Z_ZoneSize(void)
     return 0;
 }
 
+void Z_SetPurgeCallback(void (*callback)(void))
+{
+    purge_callback = callback;
+}
+
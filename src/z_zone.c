@@ -67,6 +67,7 @@ typedef struct
 static memzone_t *mainzone;
 static boolean zero_on_free;
 static boolean scan_on_free;
+static void (*purge_callback)(void);
 
 
 //
@@ -185,6 +186,11 @@ void Z_Free (void* ptr)
     if (block->id != ZONEID)
 	I_Error ("Z_Free: freed a pointer without ZONEID");
 
+    if (block->tag >= PU_PURGELEVEL && purge_callback != NULL)
+    {
+        purge_callback();
+    }
+
     if (block->tag != PU_FREE && block->user != NULL)
     {
     	// clear the user's mark
@@ -550,3 +556,8 @@ unsigned int Z_ZoneSize(void)
     return mainzone->size;
 }
 
+void Z_SetPurgeCallback(void (*callback)(void))
+{
+    purge_callback = callback;
+}
+
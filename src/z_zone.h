@@ -62,6 +62,10 @@ void    Z_ChangeUser(void *ptr, void **user);
 int     Z_FreeMemory (void);
 unsigned int Z_ZoneSize(void);
 
+// Sets a function to call before purgable blocks are freed, such as to make
+// room, for anything that may still be using them.
+void    Z_SetPurgeCallback(void (*callback)(void));
+
 //
 // This is used to get the local FILE:LINE info from CPP
 // prior to really call the function in question.